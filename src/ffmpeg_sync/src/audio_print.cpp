@@ -0,0 +1,490 @@
+#include "audio_print.hpp"
+
+#include "ffmpeg_wrappers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <unordered_map>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+using namespace ffmpeg;
+
+namespace {
+	const int kRate = 8000;
+	const int kWindow = 2048;
+	const int kStep = int(AudioPrints::kHop * kRate / 1000);
+
+	const int kBands = 33;
+	const double kLowHz = 300;
+	const double kHighHz = 2000;
+
+	// Mean square of a window 60 dB below full scale
+	const float kSilence = 1e-6f;
+
+	inline int popcount(uint32_t value) {
+#ifdef _MSC_VER
+		return (int)__popcnt(value);
+#else
+		return __builtin_popcount(value);
+#endif
+	}
+
+	// Adds every channel of the frame into mono, (sample - bias) * scale
+	template<typename T>
+	void mix(const AVFrame* frame, bool planar, float bias, float scale, std::vector<float>& into) {
+		const int channels = std::max(1, frame->ch_layout.nb_channels);
+		const float gain = scale / channels;
+
+		into.assign(frame->nb_samples, 0.f);
+
+		for (int c = 0; c < channels; c++) {
+			const T* data = (const T*) frame->extended_data[planar ? c : 0];
+
+			const int offset = planar ? 0 : c;
+			const int step = planar ? 1 : channels;
+
+			for (int i = 0; i < frame->nb_samples; i++) {
+				into[i] += (float(data[offset + i * step]) - bias) * gain;
+			}
+		}
+	}
+
+	bool toMono(const AVFrame* frame, std::vector<float>& into) {
+		switch (frame->format) {
+			case AV_SAMPLE_FMT_U8:   mix<uint8_t>(frame, false, 128, 1 / 128.f, into); break;
+			case AV_SAMPLE_FMT_U8P:  mix<uint8_t>(frame, true, 128, 1 / 128.f, into); break;
+			case AV_SAMPLE_FMT_S16:  mix<int16_t>(frame, false, 0, 1 / 32768.f, into); break;
+			case AV_SAMPLE_FMT_S16P: mix<int16_t>(frame, true, 0, 1 / 32768.f, into); break;
+			case AV_SAMPLE_FMT_S32:  mix<int32_t>(frame, false, 0, 1 / 2147483648.f, into); break;
+			case AV_SAMPLE_FMT_S32P: mix<int32_t>(frame, true, 0, 1 / 2147483648.f, into); break;
+			case AV_SAMPLE_FMT_FLT:  mix<float>(frame, false, 0, 1, into); break;
+			case AV_SAMPLE_FMT_FLTP: mix<float>(frame, true, 0, 1, into); break;
+			case AV_SAMPLE_FMT_DBL:  mix<double>(frame, false, 0, 1, into); break;
+			case AV_SAMPLE_FMT_DBLP: mix<double>(frame, true, 0, 1, into); break;
+			default: return false;
+		}
+
+		return true;
+	}
+
+	// Power spectrum of a Hann windowed block of kWindow samples, radix 2
+	class Spectrum {
+		std::vector<std::complex<float>> twiddles;
+		std::vector<int> reversed;
+		std::vector<float> hann;
+
+		std::vector<std::complex<float>> work;
+
+	public:
+		Spectrum() : twiddles(kWindow / 2), reversed(kWindow), hann(kWindow), work(kWindow) {
+			const double pi = std::acos(-1.0);
+
+			int bits = 0;
+
+			while ((1 << bits) < kWindow) {
+				bits++;
+			}
+
+			for (int i = 0; i < kWindow; i++) {
+				int r = 0;
+
+				for (int b = 0; b < bits; b++) {
+					r |= ((i >> b) & 1) << (bits - 1 - b);
+				}
+
+				reversed[i] = r;
+				hann[i] = float(0.5 - 0.5 * std::cos(2 * pi * i / kWindow));
+			}
+
+			for (int i = 0; i < kWindow / 2; i++) {
+				twiddles[i] = std::polar(1.f, float(-2 * pi * i / kWindow));
+			}
+		}
+
+		// into[k] for the kWindow / 2 bins below Nyquist
+		void power(const float* samples, std::vector<float>& into) {
+			for (int i = 0; i < kWindow; i++) {
+				work[reversed[i]] = samples[i] * hann[i];
+			}
+
+			for (int size = 2; size <= kWindow; size *= 2) {
+				const int half = size / 2;
+				const int stride = kWindow / size;
+
+				for (int start = 0; start < kWindow; start += size) {
+					for (int k = 0; k < half; k++) {
+						auto odd = work[start + k + half] * twiddles[k * stride];
+
+						work[start + k + half] = work[start + k] - odd;
+						work[start + k] += odd;
+					}
+				}
+			}
+
+			into.resize(kWindow / 2);
+
+			for (int k = 0; k < kWindow / 2; k++) {
+				into[k] = std::norm(work[k]);
+			}
+		}
+	};
+
+	// Turns decoded frames of one stream into prints, through an 8 kHz mono
+	// signal cut into overlapping windows
+	class Printer {
+		std::vector<AudioPrint>& prints;
+
+		Spectrum spectrum;
+		int edges[kBands + 1];
+
+		// Box filter down to kRate, input samples are spread over output
+		// samples by their position in time
+		int rate = 0;
+		int64_t inputs = 0;
+		int64_t outputs = 0;
+
+		float sum = 0;
+		int count = 0;
+		float last = 0;
+
+		int64_t origin = 0;             // ms of the first output sample
+		std::vector<float> signal;
+		int64_t dropped = 0;            // Output samples no longer in signal
+		size_t next = 0;                // Start of the next window in signal
+
+		std::vector<float> mono;
+		std::vector<float> power;
+
+		float previous[kBands] = {};
+		bool first = true;
+
+		void restart(int64_t pts, int sampleRate) {
+			rate = sampleRate;
+			inputs = 0;
+			outputs = 0;
+
+			sum = 0;
+			count = 0;
+
+			origin = pts;
+			signal.clear();
+			dropped = 0;
+			next = 0;
+
+			first = true;
+		}
+
+		void window(const float* samples, int64_t pts) {
+			spectrum.power(samples, power);
+
+			float energy = 0;
+
+			for (int i = 0; i < kWindow; i++) {
+				energy += samples[i] * samples[i];
+			}
+
+			float bands[kBands];
+
+			for (int b = 0; b < kBands; b++) {
+				bands[b] = 0;
+
+				for (int k = edges[b]; k < edges[b + 1]; k++) {
+					bands[b] += power[k];
+				}
+			}
+
+			uint32_t bits = 0;
+
+			for (int b = 0; b + 1 < kBands; b++) {
+				float now = bands[b] - bands[b + 1];
+				float before = previous[b] - previous[b + 1];
+
+				if (!first && now - before > 0) {
+					bits |= 1u << b;
+				}
+			}
+
+			std::copy(bands, bands + kBands, previous);
+			first = false;
+
+			prints.push_back({ pts, bits, energy / kWindow });
+		}
+
+		void push(float sample) {
+			signal.push_back(sample);
+
+			while (signal.size() - next >= kWindow) {
+				window(signal.data() + next, origin + (dropped + int64_t(next)) * 1000 / kRate);
+				next += kStep;
+			}
+
+			if (next >= 16 * kWindow) {
+				signal.erase(signal.begin(), signal.begin() + next);
+				dropped += next;
+				next = 0;
+			}
+		}
+
+	public:
+		explicit Printer(std::vector<AudioPrint>& prints) : prints(prints) {
+			const double binHz = double(kRate) / kWindow;
+
+			for (int b = 0; b <= kBands; b++) {
+				double hz = kLowHz * std::pow(kHighHz / kLowHz, double(b) / kBands);
+				edges[b] = int(std::lround(hz / binHz));
+
+				if (b > 0) {
+					edges[b] = std::max(edges[b], edges[b - 1] + 1);
+				}
+			}
+		}
+
+		void add(const AVFrame* frame, int64_t pts) {
+			if (frame->sample_rate <= 0 || !toMono(frame, mono)) {
+				return;
+			}
+
+			// Gaps and overlaps in the timestamps start a new signal
+			const int64_t expected = origin + inputs * 1000 / std::max(rate, 1);
+
+			if (rate != frame->sample_rate || (pts != AV_NOPTS_VALUE && std::abs(pts - expected) > 4 * AudioPrints::kHop)) {
+				restart(pts != AV_NOPTS_VALUE ? pts : expected, frame->sample_rate);
+			}
+
+			for (float sample : mono) {
+				sum += sample;
+				count++;
+				inputs++;
+
+				while (inputs * kRate >= (outputs + 1) * rate) {
+					last = count ? sum / count : last;
+					push(last);
+
+					sum = 0;
+					count = 0;
+					outputs++;
+				}
+			}
+		}
+	};
+}
+
+bool AudioPrints::build(const std::string& path) {
+	prints.clear();
+
+	MValue<AVFormatContext> format;
+
+	guard(avformat_open_input(format.cdata(), path.data(), nullptr, nullptr));
+	guard(avformat_find_stream_info(format, nullptr));
+
+	MValue<AVCodec> decoderType;
+
+	int stream = av_find_best_stream(format, AVMediaType::AVMEDIA_TYPE_AUDIO, -1, -1, (const AVCodec **) decoderType.cdata(), 0);
+
+	if (stream < 0) {
+		return false;
+	}
+
+	// Only the chosen stream is demuxed
+	for (unsigned int idx = 0; idx < format->nb_streams; idx++) {
+		format->streams[idx]->discard = AVDISCARD_ALL;
+	}
+
+	format->streams[stream]->discard = AVDISCARD_DEFAULT;
+
+	const AVRational timeBase = format->streams[stream]->time_base;
+
+	MValue<AVCodecContext> decoder = avcodec_alloc_context3(decoderType);
+
+	guard(avcodec_parameters_to_context(decoder, format->streams[stream]->codecpar));
+	decoder->pkt_timebase = timeBase;
+
+	guard(avcodec_open2(decoder, decoderType, nullptr));
+
+	MValue<AVPacket> packet = av_packet_alloc();
+	MValue<AVFrame> frame = av_frame_alloc();
+
+	Printer printer{ prints };
+
+	auto drain = [&] {
+		while (avcodec_receive_frame(decoder, frame) == 0) {
+			int64_t pts = frame->pts != AV_NOPTS_VALUE ? av_rescale_q(frame->pts, timeBase, { 1, 1000 }) : AV_NOPTS_VALUE;
+
+			printer.add(frame, pts);
+			av_frame_unref(frame);
+		}
+	};
+
+	while (true) {
+		int read = av_read_frame(format, packet);
+
+		if (read == AVERROR_EOF) {
+			break;
+		} else {
+			guard(read);
+		}
+
+		if (packet->stream_index == stream) {
+			// A broken packet costs a few prints, not the whole pass
+			int sent = avcodec_send_packet(decoder, packet);
+
+			if (sent != AVERROR_INVALIDDATA) {
+				guard(sent);
+			}
+
+			drain();
+		}
+
+		av_packet_unref(packet);
+	}
+
+	guard(avcodec_send_packet(decoder, nullptr));
+	drain();
+
+	return true;
+}
+
+std::vector<AudioSegment> alignAudio(const AudioPrints& refPrints, const AudioPrints& srcPrints) {
+	// Prints of src voting together, about 2 s
+	const size_t kBlock = 64;
+	const int kMinVotes = 4;
+
+	// Prints this common can't place anything
+	const size_t kMaxBucket = 64;
+
+	// Share of differing bits that still counts as the same audio
+	const double kMaxErrors = 0.35;
+
+	const int64_t kSlack = 2 * AudioPrints::kHop;
+	const int kMinBlocks = 2;
+
+	auto& ref = refPrints.entries();
+	auto& src = srcPrints.entries();
+
+	std::unordered_map<uint32_t, std::vector<uint32_t>> table;
+
+	for (size_t j = 0; j < ref.size(); j++) {
+		if (ref[j].energy >= kSilence) {
+			table[ref[j].bits].push_back(uint32_t(j));
+		}
+	}
+
+	// Mean bit errors of src [from, to) against ref shifted by shift prints,
+	// 1 when too little of it is audible on both sides
+	auto errorRate = [&](size_t from, size_t to, int64_t shift) {
+		size_t errors = 0;
+		size_t compared = 0;
+
+		for (size_t i = from; i < to; i++) {
+			int64_t j = int64_t(i) + shift;
+
+			if (j < 0 || j >= int64_t(ref.size()) || src[i].energy < kSilence || ref[j].energy < kSilence) {
+				continue;
+			}
+
+			errors += popcount(src[i].bits ^ ref[j].bits);
+			compared++;
+		}
+
+		return compared >= (to - from) / 4 && compared > 0 ? double(errors) / (compared * 32) : 1.0;
+	};
+
+	std::vector<AudioSegment> segments;
+
+	AudioSegment current{};
+	int blocks = 0;
+	int64_t shift = 0;
+
+	auto close = [&] {
+		if (blocks >= kMinBlocks) {
+			segments.push_back(current);
+		}
+
+		blocks = 0;
+	};
+
+	for (size_t from = 0; from < src.size(); from += kBlock) {
+		const size_t to = std::min(from + kBlock, src.size());
+
+		std::unordered_map<int64_t, int> votes;
+
+		for (size_t i = from; i < to; i++) {
+			if (src[i].energy < kSilence) {
+				continue;
+			}
+
+			// The print itself and every print one flipped bit away
+			for (int flip = -1; flip < 32; flip++) {
+				auto bucket = table.find(flip < 0 ? src[i].bits : src[i].bits ^ (1u << flip));
+
+				if (bucket == table.end() || bucket->second.size() > kMaxBucket) {
+					continue;
+				}
+
+				for (auto j : bucket->second) {
+					votes[int64_t(j) - int64_t(i)]++;
+				}
+			}
+		}
+
+		int64_t bestShift = 0;
+		int bestVotes = 0;
+
+		for (auto [candidate, count] : votes) {
+			if (count > bestVotes) {
+				bestShift = candidate;
+				bestVotes = count;
+			}
+		}
+
+		bool found = false;
+
+		if (bestVotes >= kMinVotes && errorRate(from, to, bestShift) <= kMaxErrors) {
+			found = true;
+		} else if (blocks > 0 && errorRate(from, to, shift) <= kMaxErrors) {
+			// Too few exact prints, the offset so far still fits
+			found = true;
+			bestShift = shift;
+		}
+
+		if (!found) {
+			close();
+			continue;
+		}
+
+		// Offset in ms from the first print of the block that has a partner
+		int64_t delta = 0;
+
+		for (size_t i = from; i < to; i++) {
+			int64_t j = int64_t(i) + bestShift;
+
+			if (j >= 0 && j < int64_t(ref.size())) {
+				delta = ref[j].pts - src[i].pts;
+				break;
+			}
+		}
+
+		const int64_t end = src[to - 1].pts + AudioPrints::kHop;
+
+		if (blocks > 0 && std::abs(delta - current.delta) <= kSlack) {
+			current.srcEnd = end;
+			blocks++;
+		} else {
+			close();
+
+			current = { src[from].pts, end, delta };
+			blocks = 1;
+		}
+
+		shift = bestShift;
+	}
+
+	close();
+
+	return segments;
+}
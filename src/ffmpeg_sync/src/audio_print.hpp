@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+	Audio level alignment.
+
+	The best audio stream is decoded, mixed to mono and brought down to 8 kHz.
+	Every 32 ms a windowed FFT gives the energy of 33 bands between 300 Hz
+	and 2 kHz, and a 32 bit print tells for each pair of neighbouring bands
+	if their difference grew since the last window. Equal prints in ref and
+	src vote on an offset per couple of seconds of src, runs of agreeing
+	offsets become segments. Decoding and hashing audio costs a fraction of
+	decoding video, the video only has to settle where the segments meet.
+*/
+
+struct AudioPrint {
+	int64_t pts;
+
+	uint32_t bits;
+	float energy;    // Mean square of the window, tells silence apart
+};
+
+class AudioPrints {
+	std::vector<AudioPrint> prints;
+
+public:
+	static constexpr int64_t kHop = 32;    // ms between prints
+
+	// False if the file has no audio stream
+	bool build(const std::string& path);
+
+	bool empty() const {
+		return prints.empty();
+	}
+
+	const std::vector<AudioPrint>& entries() const {
+		return prints;
+	}
+};
+
+// Stretch of src whose audio shows up in ref, moved by delta
+struct AudioSegment {
+	int64_t srcStart;
+	int64_t srcEnd;
+
+	int64_t delta;
+};
+
+// Segments in src order. Silence and audio without a clear offset fall
+// between them.
+std::vector<AudioSegment> alignAudio(const AudioPrints& ref, const AudioPrints& src);
@@ -0,0 +1,199 @@
+#include "coarse_align.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstdlib>
+
+using namespace ffmpeg;
+
+namespace {
+	int64_t medianSpacing(const std::vector<Thumb>& thumbs) {
+		if (thumbs.size() < 2) {
+			return 0;
+		}
+
+		std::vector<int64_t> spacing;
+
+		for (size_t i = 1; i < thumbs.size(); i++) {
+			spacing.push_back(thumbs[i].start() - thumbs[i - 1].start());
+		}
+
+		std::nth_element(spacing.begin(), spacing.begin() + spacing.size() / 2, spacing.end());
+		return spacing[spacing.size() / 2];
+	}
+
+	// Flat frames are near every print, they can't place anything
+	bool isDistinct(const Fingerprint& print) {
+		size_t confident = 0;
+
+		for (auto word : print.mask) {
+			confident += std::bitset<64>(word).count();
+		}
+
+		return confident >= Fingerprint::kBits / 8;
+	}
+}
+
+std::vector<Thumb> readAll(ThumbSource& source) {
+	std::vector<Thumb> thumbs;
+	Thumb thumb;
+
+	while (source.read(thumb) != FrameResult::END) {
+		thumbs.push_back(std::move(thumb));
+	}
+
+	return thumbs;
+}
+
+CoarsePath alignKeyframes(const std::vector<Thumb>& ref, const std::vector<Thumb>& src, int maxDistance) {
+	CoarsePath path;
+
+	// A src keyframe may pair with a ref keyframe up to one ref GOP away
+	path.tolerance = medianSpacing(ref) * 3 / 2;
+
+	std::vector<CoarsePoint> pairs;
+
+	// Thousands of keyframes at most, brute force popcounts are fine
+	for (auto& frame : src) {
+		if (!isDistinct(frame.print)) {
+			continue;
+		}
+
+		const Thumb* best = nullptr;
+		int bestDistance = maxDistance + 1;
+
+		for (auto& candidate : ref) {
+			if (!isDistinct(candidate.print)) {
+				continue;
+			}
+
+			int bits = distance(frame.print, candidate.print);
+
+			if (bits < bestDistance) {
+				best = &candidate;
+				bestDistance = bits;
+			}
+		}
+
+		if (best) {
+			pairs.push_back({ best->start(), frame.start() });
+		}
+	}
+
+	// Both files play in the same order, a pair going back in ref is a
+	// repeated shot or a lookalike. Keeps the longest chain of pairs rising
+	// in both, found like a longest increasing subsequence: tails[k] is the
+	// pair ending the best chain of k + 1 pairs seen so far.
+	std::vector<size_t> tails;
+	std::vector<size_t> before(pairs.size());
+
+	for (size_t i = 0; i < pairs.size(); i++) {
+		auto it = std::lower_bound(tails.begin(), tails.end(), pairs[i].ref, [&](size_t tail, int64_t pts) {
+			return pairs[tail].ref < pts;
+		});
+
+		before[i] = it == tails.begin() ? pairs.size() : *(it - 1);
+
+		if (it == tails.end()) {
+			tails.push_back(i);
+		} else {
+			*it = i;
+		}
+	}
+
+	path.points.resize(tails.size());
+
+	for (size_t i = tails.empty() ? pairs.size() : tails.back(), k = tails.size(); k > 0; i = before[i]) {
+		path.points[--k] = pairs[i];
+	}
+
+	return path;
+}
+
+std::vector<CoarseSegment> CoarsePath::segments() const {
+	std::vector<CoarseSegment> result;
+
+	auto off = [&](const CoarsePoint& point) {
+		return std::abs(point.delta() - result.back().delta()) > tolerance;
+	};
+
+	for (size_t i = 0; i < points.size(); i++) {
+		if (result.empty()) {
+			result.push_back({ points[i], points[i] });
+			continue;
+		}
+
+		if (!off(points[i])) {
+			result.back().last = points[i];
+			continue;
+		}
+
+		if (i + 1 < points.size() && !off(points[i + 1])) {
+			continue;
+		}
+
+		result.push_back({ points[i], points[i] });
+	}
+
+	return result;
+}
+
+bool estimateOffset(const std::vector<Thumb>& ref, const std::vector<Thumb>& src, int maxDistance, int64_t& offset, double& agreement) {
+	offset = 0;
+	agreement = 0;
+
+	std::vector<size_t> usable;
+
+	for (size_t i = 0; i < src.size(); i++) {
+		if (isDistinct(src[i].print)) {
+			usable.push_back(i);
+		}
+	}
+
+	if (usable.empty() || ref.empty()) {
+		return false;
+	}
+
+	// Ref frame on screen at pts, nullptr in a gap or outside ref
+	auto showing = [&](int64_t pts) -> const Thumb* {
+		auto after = std::upper_bound(ref.begin(), ref.end(), pts, [](int64_t pts, const Thumb& thumb) {
+			return pts < thumb.start();
+		});
+
+		if (after == ref.begin() || pts >= (after - 1)->end()) {
+			return nullptr;
+		}
+
+		return &*(after - 1);
+	};
+
+	bool covered = false;
+	size_t bestHits = 0;
+
+	for (auto& first : ref) {
+		const int64_t shift = first.start() - src.front().start();
+
+		// The whole src window has to fall within ref
+		if (src.back().end() + shift > ref.back().end()) {
+			break;
+		}
+
+		size_t hits = 0;
+
+		for (auto i : usable) {
+			auto paired = showing(src[i].start() + shift);
+			hits += paired && distance(paired->print, src[i].print) <= maxDistance;
+		}
+
+		if (!covered || hits > bestHits) {
+			offset = shift;
+			bestHits = hits;
+		}
+
+		covered = true;
+	}
+
+	agreement = double(bestHits) / usable.size();
+
+	return covered;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "thumb_source.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+	Coarse alignment from keyframes only.
+
+	Both files are decoded with non-key frames skipped, which costs a small
+	fraction of a full decode. Every src keyframe is paired with the ref
+	keyframe of the closest fingerprint, and only the longest run of pairs
+	moving forward in both files is kept. Keyframes of two encodes rarely fall
+	on the same frame, so a pair is only accurate to about one GOP, but that
+	is enough to tell where the offset between the files changes, and bound
+	the full rate search to the GOPs around those places. Offset changes
+	smaller than that are not seen.
+*/
+
+struct CoarsePoint {
+	int64_t ref;
+	int64_t src;
+
+	int64_t delta() const {
+		return ref - src;
+	}
+};
+
+// Stretch of the path at one offset, from its first point to its last
+struct CoarseSegment {
+	CoarsePoint first;
+	CoarsePoint last;
+
+	int64_t delta() const {
+		return first.delta();
+	}
+};
+
+struct CoarsePath {
+	std::vector<CoarsePoint> points;    // Sorted by src
+
+	// Offsets closer than this are considered equal
+	int64_t tolerance = 0;
+
+	// Splits the path where the offset moves by more than tolerance. A single
+	// stray point is more likely a repeated shot than an edit, it is skipped.
+	std::vector<CoarseSegment> segments() const;
+};
+
+// Reads every thumbnail of source
+std::vector<Thumb> readAll(ThumbSource& source);
+
+// Pairs keyframes whose fingerprints are at most maxDistance apart. Flat
+// keyframes are left out, and pairs that would go back in ref are dropped.
+CoarsePath alignKeyframes(const std::vector<Thumb>& ref, const std::vector<Thumb>& src, int maxDistance);
+
+// Shift of ref against src where their fingerprints agree best, as
+// ref pts - src pts. Each ref frame start is tried as the place of the
+// first src frame, every src frame is then paired with the ref frame on
+// screen at its own pts, so dropped frames and other frame rates don't
+// throw the pairs off. Both are meant to be a few thousand frames at most.
+// agreement is the share of usable src frames within maxDistance at that
+// shift. False if it can't be told: no src frame is distinct enough, or ref
+// doesn't cover the src window at any shift.
+bool estimateOffset(const std::vector<Thumb>& ref, const std::vector<Thumb>& src, int maxDistance, int64_t& offset, double& agreement);
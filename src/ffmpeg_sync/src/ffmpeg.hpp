@@ -6,4 +6,5 @@ extern "C" {
     #include <libavfilter/buffersink.h>
     #include <libavfilter/buffersrc.h>
     #include <libavutil/mathematics.h>
+    #include <libavutil/audio_fifo.h>
 }
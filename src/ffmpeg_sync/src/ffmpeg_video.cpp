@@ -1,9 +1,24 @@
 
 #include "ffmpeg_video.hpp"
+#include "packet_index.hpp"
+
+#include <algorithm>
+#include <cstdint>
 
 using namespace ffmpeg;
 
-void Video::open(const char* path) {
+DecodeProfile DecodeProfile::thumbnails() {
+    DecodeProfile profile;
+
+    profile.lowres = 1;
+    profile.skipLoopFilter = AVDISCARD_ALL;
+    profile.skipIdct = AVDISCARD_NONREF;
+    profile.fast = true;
+
+    return profile;
+}
+
+void Video::open(const char* path, const DecodeProfile& profile) {
     MValue<AVFormatContext> format;
 
     guard(avformat_open_input(format.cdata(), path, nullptr, nullptr));
@@ -18,6 +33,15 @@ void Video::open(const char* path) {
     decoder = avcodec_alloc_context3(decoderType);
     decoder->thread_count = 0;
 
+    // Has to be set before the decoder opens, most modern codecs don't do lowres at all
+    decoder->lowres = std::min<int>(profile.lowres, decoderType->max_lowres);
+    decoder->skip_loop_filter = profile.skipLoopFilter;
+    decoder->skip_idct = profile.skipIdct;
+
+    if (profile.fast) {
+        decoder->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+
     for (unsigned int idx = 0; idx < format->nb_streams; idx++) {
         if (idx == stream) {
             continue;
@@ -97,17 +121,45 @@ FrameResult Video::readWithNext(MFrame& into) {
 void Video::seek(int64_t pts) {
     avcodec_flush_buffers(decoder);
 
-    guard(avformat_seek_file(format, stream, INT64_MIN, pts, pts, AVSEEK_FLAG_BACKWARD));
+    const PacketEntry* key = index ? index->keyframeBefore(pts) : nullptr;
 
-    while (true) {
-        read(buffer);
+    size_t budget = SIZE_MAX;
+
+    if (key) {
+        // Decoding forward never takes more than the frames up to pts, plus
+        // whatever the decoder holds back for reordering
+        budget = index->countBetween(key->pts, pts) + decoder->has_b_frames + 1;
 
-        if (buffer->pts >= pts) {
+        // Without an index of its own the demuxer would bisect the file, the
+        // byte offset is known already
+        bool byBytes = key->pos >= 0
+            && avformat_index_get_entries_count(format->streams[stream]) == 0
+            && !(format->iformat->flags & AVFMT_NO_BYTE_SEEK);
+
+        if (byBytes) {
+            guard(avformat_seek_file(format, stream, INT64_MIN, key->pos, key->pos, AVSEEK_FLAG_BYTE));
+        } else {
+            guard(avformat_seek_file(format, stream, INT64_MIN, key->pts, key->pts, AVSEEK_FLAG_BACKWARD));
+        }
+    } else {
+        guard(avformat_seek_file(format, stream, INT64_MIN, pts, pts, AVSEEK_FLAG_BACKWARD));
+    }
+
+    for (size_t frames = 0; frames < budget; frames++) {
+        if (read(buffer) == FrameResult::END || buffer->pts >= pts) {
             break;
         }
     }
 }
 
+void Video::useIndex(const PacketIndex* index) {
+    this->index = index;
+}
+
+void Video::skipFrames(AVDiscard discard) {
+    decoder->skip_frame = discard;
+}
+
 AVRational Video::getTimeBase() const {
     return format->streams[stream]->time_base;
 }
@@ -12,6 +12,19 @@ namespace ffmpeg {
 
 	class Video;
 	class VideoGraph;
+	class PacketIndex;
+
+	// Decoder shortcuts for when only a small thumbnail of each frame is
+	// kept. All of them trade picture quality for speed.
+	struct DecodeProfile {
+		int lowres = 0;                                  // Halvings of the picture, capped by what the codec supports
+		AVDiscard skipLoopFilter = AVDISCARD_DEFAULT;    // Frames decoded without deblocking
+		AVDiscard skipIdct = AVDISCARD_DEFAULT;          // Frames decoded without residuals
+		bool fast = false;                               // AV_CODEC_FLAG2_FAST, non spec compliant shortcuts
+
+		// Everything that still leaves a usable thumbnail
+		static DecodeProfile thumbnails();
+	};
 
 	class Video {
 		MValue<AVFormatContext> format;
@@ -22,20 +35,29 @@ namespace ffmpeg {
 		MValue<AVPacket> packet;
 		MFrame buffer;
 
+		const PacketIndex* index = nullptr;
+
 	public:
 		Video() = default;
 		
-		Video(const char* path) {
-			open(path);
+		Video(const char* path, const DecodeProfile& profile = {}) {
+			open(path, profile);
 		}
-		Video(const std::string& path) {
-			open(path.data());
+		Video(const std::string& path, const DecodeProfile& profile = {}) {
+			open(path.data(), profile);
 		}
 
-		void open(const char* path);
+		void open(const char* path, const DecodeProfile& profile = {});
 		
 		void seek(int64_t pts);
 
+		// Lets seek go straight to the keyframe before the target, the index
+		// has to outlive the video
+		void useIndex(const PacketIndex* index);
+
+		// Frames the decoder drops without decoding, AVDISCARD_NONKEY leaves keyframes only
+		void skipFrames(AVDiscard discard);
+
 		FrameResult read(MFrame& into);
 		FrameResult readWithNext(MFrame& into);
 
@@ -18,6 +18,8 @@ namespace ffmpeg {
 
 		inline void free(AVBufferSrcParameters** ptr) { av_free(*ptr); }
 
+		inline void free(AVAudioFifo** ptr) { if (*ptr) av_audio_fifo_free(*ptr); }
+
 		// In .data section, or freed by owner
 		inline void free(AVCodec** ptr) {};
 		inline void free(AVFilterContext** ptr) {};
@@ -0,0 +1,131 @@
+#include "fingerprint.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace {
+	const int kGridW = 17;
+	const int kGridH = 16;
+
+	// Block means are kept in 1/16 gray levels. Neighbours closer than the
+	// margin are left out of the mask, in flat or busy areas the sign of their
+	// difference is decided by noise.
+	const int kMeanScale = 16;
+	const int kMargin = 2 * kMeanScale;
+
+	inline int popcount(uint64_t value) {
+#ifdef _MSC_VER
+		return (int)__popcnt64(value);
+#else
+		return __builtin_popcountll(value);
+#endif
+	}
+}
+
+Fingerprint Fingerprint::of(const uint8_t* pixels, ptrdiff_t stride, int width, int height) {
+	uint32_t sums[kGridH][kGridW] = {};
+	int means[kGridH][kGridW];
+
+	for (int gy = 0; gy < kGridH; gy++) {
+		const int y0 = gy * height / kGridH;
+		const int y1 = (gy + 1) * height / kGridH;
+
+		for (int y = y0; y < y1; y++) {
+			const uint8_t* line = pixels + stride * y;
+
+			for (int gx = 0; gx < kGridW; gx++) {
+				const int x0 = gx * width / kGridW;
+				const int x1 = (gx + 1) * width / kGridW;
+
+				for (int x = x0; x < x1; x++) {
+					sums[gy][gx] += line[x];
+				}
+			}
+		}
+
+		for (int gx = 0; gx < kGridW; gx++) {
+			const int count = (y1 - y0) * ((gx + 1) * width / kGridW - gx * width / kGridW);
+
+			means[gy][gx] = count ? (int)(sums[gy][gx] * kMeanScale / count) : 0;
+		}
+	}
+
+	Fingerprint result;
+
+	for (int gy = 0; gy < kGridH; gy++) {
+		for (int gx = 0; gx < kGridW - 1; gx++) {
+			const int bit = gy * (kGridW - 1) + gx;
+			const int delta = means[gy][gx] - means[gy][gx + 1];
+
+			if (delta > 0) {
+				result.bits[bit / 64] |= 1ULL << (bit % 64);
+			}
+			if (std::abs(delta) > kMargin) {
+				result.mask[bit / 64] |= 1ULL << (bit % 64);
+			}
+		}
+	}
+
+	for (int cy = 0; cy < kCoarse; cy++) {
+		const int y0 = cy * height / kCoarse;
+		const int y1 = (cy + 1) * height / kCoarse;
+
+		for (int cx = 0; cx < kCoarse; cx++) {
+			const int x0 = cx * width / kCoarse;
+			const int x1 = (cx + 1) * width / kCoarse;
+
+			uint32_t sum = 0;
+
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* line = pixels + stride * y;
+
+				for (int x = x0; x < x1; x++) {
+					sum += line[x];
+				}
+			}
+
+			const int count = (y1 - y0) * (x1 - x0);
+
+			result.coarse[cy * kCoarse + cx] = uint8_t(count ? (sum + count / 2) / count : 0);
+		}
+	}
+
+	return result;
+}
+
+int distance(const Fingerprint& a, const Fingerprint& b) {
+	int result = 0;
+
+	for (int i = 0; i < Fingerprint::kBits / 64; i++) {
+		result += popcount((a.bits[i] ^ b.bits[i]) & a.mask[i] & b.mask[i]);
+	}
+
+	return result;
+}
+
+double coarseDiff(const Fingerprint& a, const Fingerprint& b) {
+	int sum = 0;
+
+	for (int i = 0; i < Fingerprint::kCoarse * Fingerprint::kCoarse; i++) {
+		sum += std::abs(a.coarse[i] - b.coarse[i]);
+	}
+
+	return sum / (255.0 * Fingerprint::kCoarse * Fingerprint::kCoarse);
+}
+
+Thumb::Thumb(const ffmpeg::MFrame& frame)
+	: width(frame->width), height(frame->height), pixels(width * height), pts(frame.start()), next(frame.end()) {
+
+	const uint8_t* plane = frame->data[0];
+	const int stride = frame->linesize[0];
+
+	for (int y = 0; y < height; y++) {
+		std::memcpy(&pixels[y * width], plane + stride * y, width);
+	}
+
+	print = Fingerprint::of(pixels.data(), width, width, height);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ffmpeg_wrappers.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// 256 bit difference hash (dHash) of a luma plane. The plane is averaged down
+// to 17x16 blocks, every bit tells if a block is brighter than its right
+// neighbour. Survives scaling, mild blur and encoder noise, and two prints are
+// compared with a handful of popcounts.
+struct Fingerprint {
+	static constexpr int kBits = 256;
+
+	uint64_t bits[kBits / 64] = {};
+	uint64_t mask[kBits / 64] = {};    // Bits whose blocks differ clearly, the rest is noise
+
+	// Mean gray of a 4x4 grid, what tells flat frames apart when the bits can't
+	static constexpr int kCoarse = 4;
+	uint8_t coarse[kCoarse * kCoarse] = {};
+
+	static Fingerprint of(const uint8_t* pixels, ptrdiff_t stride, int width, int height);
+};
+
+// Number of bits set differently while confident in both prints, 0 .. Fingerprint::kBits.
+// Flat frames have few confident bits, they are never far from anything.
+int distance(const Fingerprint& a, const Fingerprint& b);
+
+// Mean absolute difference of the coarse grids, in [0, 1]. Never more than
+// the mean difference of the pictures themselves.
+double coarseDiff(const Fingerprint& a, const Fingerprint& b);
+
+// What the matcher keeps of a decoded thumbnail: a tightly packed copy of the
+// luma plane for exact comparison, its fingerprint and its time span. The
+// AVFrame itself goes back to the decoder right away.
+struct Thumb {
+	int width = 0;
+	int height = 0;
+
+	std::vector<uint8_t> pixels;
+	Fingerprint print;
+
+	int64_t pts = 0;
+	int64_t next = 0;
+
+	Thumb() = default;
+	explicit Thumb(const ffmpeg::MFrame& frame);
+
+	int64_t start() const {
+		return pts;
+	}
+	int64_t end() const {
+		return next;
+	}
+};
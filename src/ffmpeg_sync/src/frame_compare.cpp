@@ -0,0 +1,260 @@
+#include "frame_compare.hpp"
+
+#include <cstdlib>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define FS_X86 1
+
+	#include <immintrin.h>
+
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	#define FS_NEON 1
+
+	#include <arm_neon.h>
+#endif
+
+// GCC and Clang only emit AVX2 inside functions marked for it, MSVC always does.
+// SSE2 is part of x86-64 but not of 32 bit x86, it is marked and checked there too.
+#if defined(FS_X86) && !defined(_MSC_VER)
+	#define FS_TARGET_AVX2 __attribute__((target("avx2")))
+	#define FS_TARGET_SSE2 __attribute__((target("sse2")))
+#else
+	#define FS_TARGET_AVX2
+	#define FS_TARGET_SSE2
+#endif
+
+namespace {
+
+	using Kernel = uint64_t(*)(const uint8_t*, ptrdiff_t, const uint8_t*, ptrdiff_t, int, int, uint64_t);
+
+	// Rows between checks against the limit, a 96x54 thumbnail gets 7 chances to bail
+	const int kRowsPerCheck = 8;
+
+	inline uint64_t sadTail(const uint8_t* a, const uint8_t* b, int from, int to) {
+		uint64_t sum = 0;
+
+		for (int x = from; x < to; x++) {
+			sum += std::abs(a[x] - b[x]);
+		}
+
+		return sum;
+	}
+
+	uint64_t sadScalar(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit) {
+		uint64_t sum = 0;
+
+		for (int y = 0; y < height; y++) {
+			sum += sadTail(a + strideA * y, b + strideB * y, 0, width);
+
+			if (sum > limit) {
+				break;
+			}
+		}
+
+		return sum;
+	}
+
+#ifdef FS_X86
+
+	FS_TARGET_SSE2
+	uint64_t sadSSE2(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit) {
+		const int vecWidth = width & ~15;
+
+		uint64_t sum = 0;
+
+		for (int y0 = 0; y0 < height; y0 += kRowsPerCheck) {
+			const int y1 = y0 + kRowsPerCheck < height ? y0 + kRowsPerCheck : height;
+
+			__m128i acc = _mm_setzero_si128();
+
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* lineA = a + strideA * y;
+				const uint8_t* lineB = b + strideB * y;
+
+				for (int x = 0; x < vecWidth; x += 16) {
+					__m128i va = _mm_loadu_si128((const __m128i*) (lineA + x));
+					__m128i vb = _mm_loadu_si128((const __m128i*) (lineB + x));
+
+					acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+				}
+
+				sum += sadTail(lineA, lineB, vecWidth, width);
+			}
+
+			sum += (uint32_t) _mm_cvtsi128_si32(acc) + (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+
+			if (sum > limit) {
+				break;
+			}
+		}
+
+		return sum;
+	}
+
+	FS_TARGET_AVX2
+	uint64_t sadAVX2(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit) {
+		const int vecWidth = width & ~31;
+
+		uint64_t sum = 0;
+
+		for (int y0 = 0; y0 < height; y0 += kRowsPerCheck) {
+			const int y1 = y0 + kRowsPerCheck < height ? y0 + kRowsPerCheck : height;
+
+			__m256i acc = _mm256_setzero_si256();
+
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* lineA = a + strideA * y;
+				const uint8_t* lineB = b + strideB * y;
+
+				for (int x = 0; x < vecWidth; x += 32) {
+					__m256i va = _mm256_loadu_si256((const __m256i*) (lineA + x));
+					__m256i vb = _mm256_loadu_si256((const __m256i*) (lineB + x));
+
+					acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+				}
+
+				sum += sadTail(lineA, lineB, vecWidth, width);
+			}
+
+			// The lanes of a few rows stay far below 32 bits
+			__m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+			sum += (uint32_t) _mm_cvtsi128_si32(half) + (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+
+			if (sum > limit) {
+				break;
+			}
+		}
+
+		return sum;
+	}
+
+	bool hasSSE2() {
+#if defined(__x86_64__) || defined(_M_X64)
+		return true;
+#elif defined(_MSC_VER)
+		int info[4];
+
+		__cpuid(info, 1);
+
+		return (info[3] & (1 << 26)) != 0;
+#else
+		return __builtin_cpu_supports("sse2");
+#endif
+	}
+
+	bool hasAVX2() {
+#ifdef _MSC_VER
+		int info[4];
+
+		__cpuid(info, 0);
+
+		if (info[0] < 7) {
+			return false;
+		}
+
+		// The OS has to save the YMM registers too
+		__cpuid(info, 1);
+
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx     = (info[2] & (1 << 28)) != 0;
+
+		if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+
+		__cpuidex(info, 7, 0);
+
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+#endif
+
+#ifdef FS_NEON
+
+	uint64_t sadNEON(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit) {
+		const int vecWidth = width & ~15;
+
+		uint64_t sum = 0;
+
+		for (int y0 = 0; y0 < height; y0 += kRowsPerCheck) {
+			const int y1 = y0 + kRowsPerCheck < height ? y0 + kRowsPerCheck : height;
+
+			uint32x4_t acc = vdupq_n_u32(0);
+
+			for (int y = y0; y < y1; y++) {
+				const uint8_t* lineA = a + strideA * y;
+				const uint8_t* lineB = b + strideB * y;
+
+				for (int x = 0; x < vecWidth; x += 16) {
+					uint8x16_t diff = vabdq_u8(vld1q_u8(lineA + x), vld1q_u8(lineB + x));
+
+					acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+				}
+
+				sum += sadTail(lineA, lineB, vecWidth, width);
+			}
+
+			sum += vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+
+			if (sum > limit) {
+				break;
+			}
+		}
+
+		return sum;
+	}
+
+#endif
+
+	struct Dispatch {
+		Kernel kernel;
+		const char* name;
+	};
+
+	Dispatch select() {
+#if defined(FS_X86)
+		if (hasAVX2()) {
+			return { sadAVX2, "avx2" };
+		}
+
+		if (hasSSE2()) {
+			return { sadSSE2, "sse2" };
+		}
+
+		return { sadScalar, "scalar" };
+#elif defined(FS_NEON)
+		return { sadNEON, "neon" };
+#else
+		return { sadScalar, "scalar" };
+#endif
+	}
+
+	const Dispatch& dispatch() {
+		static const Dispatch selected = select();
+		return selected;
+	}
+}
+
+uint64_t sumAbsDiff(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height) {
+	return sumAbsDiff(a, strideA, b, strideB, width, height, UINT64_MAX);
+}
+
+uint64_t sumAbsDiff(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit) {
+	// Rows narrower than a vector would run entirely in the tail loop anyway
+	if (width < 16) {
+		return sadScalar(a, strideA, b, strideB, width, height, limit);
+	}
+
+	return dispatch().kernel(a, strideA, b, strideB, width, height, limit);
+}
+
+const char* sumAbsDiffKernel() {
+	return dispatch().name;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Sum of absolute differences between two 8 bit planes. Picks the widest
+// kernel the CPU supports (AVX2, SSE2, NEON or plain C) on first use.
+uint64_t sumAbsDiff(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height);
+
+// Same, but may stop early once the partial sum exceeds limit. The result is
+// exact when it is <= limit, otherwise it is only known to be above it.
+uint64_t sumAbsDiff(const uint8_t* a, ptrdiff_t strideA, const uint8_t* b, ptrdiff_t strideB, int width, int height, uint64_t limit);
+
+// Name of the selected kernel, for diagnostics
+const char* sumAbsDiffKernel();
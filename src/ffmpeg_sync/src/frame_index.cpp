@@ -0,0 +1,401 @@
+#include "frame_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+using namespace ffmpeg;
+
+namespace {
+	// Last byte is the version, 4 since the thumbnail pixels are stored too
+	const char kMagic[8] = { 'F', 'S', 'I', 'D', 'X', 0, 0, 4 };
+
+	// Bytes hashed from both ends of the video
+	const size_t kHashedSpan = 1 << 20;
+
+	// Samples hashed from the middle, an edit in place that keeps size and
+	// mtime most likely touches one of them
+	const size_t kMiddleSamples = 64;
+	const size_t kMiddleSample = 4 << 10;
+
+	struct IndexHeader {
+		char magic[8];
+		uint32_t entrySize;
+
+		// Thumbnail size, 0 if the source had no pixels
+		uint16_t width;
+		uint16_t height;
+
+		IndexKey key;
+
+		uint64_t count;
+	};
+
+	uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+		auto bytes = (const uint8_t*)data;
+
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	// Pixel records are padded so the entries after them stay aligned
+	size_t pixelSizeOf(int width, int height) {
+		return ((size_t)width * height + 7) & ~(size_t)7;
+	}
+}
+
+struct IndexEntry {
+	int64_t pts;
+	int64_t next;
+
+	uint64_t bits[Fingerprint::kBits / 64];
+	uint64_t mask[Fingerprint::kBits / 64];
+
+	uint8_t coarse[Fingerprint::kCoarse * Fingerprint::kCoarse];
+};
+
+static_assert(sizeof(IndexEntry) == 96, "index entries are written as is");
+
+bool IndexKey::of(const std::string& videoPath, const std::string& filterDesc, IndexKey& into) {
+	std::error_code error;
+
+	auto size = std::filesystem::file_size(videoPath, error);
+	auto mtime = std::filesystem::last_write_time(videoPath, error);
+
+	if (error) {
+		return false;
+	}
+
+	std::ifstream in(videoPath, std::ios::binary);
+
+	if (!in) {
+		return false;
+	}
+
+	// Sampling both ends is enough to tell apart remuxes with a copied mtime
+	std::vector<char> span(std::min<uint64_t>(size, kHashedSpan));
+	uint64_t hash = fnv1a(&size, sizeof(size));
+
+	in.read(span.data(), span.size());
+	hash = fnv1a(span.data(), span.size(), hash);
+
+	in.seekg(size - span.size());
+	in.read(span.data(), span.size());
+	hash = fnv1a(span.data(), span.size(), hash);
+
+	if (size > 2 * kHashedSpan + kMiddleSample) {
+		const uint64_t middle = size - 2 * kHashedSpan - kMiddleSample;
+
+		span.resize(kMiddleSample);
+
+		for (size_t i = 0; i < kMiddleSamples; i++) {
+			in.seekg(kHashedSpan + middle * i / (kMiddleSamples - 1));
+			in.read(span.data(), span.size());
+			hash = fnv1a(span.data(), span.size(), hash);
+		}
+	}
+
+	if (!in) {
+		return false;
+	}
+
+	into.size = size;
+	into.mtime = mtime.time_since_epoch().count();
+	into.contentHash = hash;
+	into.filterHash = fnv1a(filterDesc.data(), filterDesc.size());
+
+	return true;
+}
+
+std::string defaultIndexPath(const std::string& videoPath, const IndexKey& key) {
+	std::error_code error;
+
+	auto path = std::filesystem::weakly_canonical(videoPath, error);
+
+	if (error) {
+		path = std::filesystem::absolute(videoPath, error);
+	}
+
+	const std::string full = path.generic_string();
+
+	uint64_t hash = fnv1a(full.data(), full.size());
+	hash = fnv1a(&key, sizeof(key), hash);
+
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+
+	auto name = path.stem().string() + "-" + hex + ".fsidx";
+
+	return (std::filesystem::temp_directory_path() / name).string();
+}
+
+bool writeIndex(const std::string& indexPath, const IndexKey& key, ThumbSource& source) {
+	const std::string tempPath = indexPath + ".tmp";
+
+	FILE* out = std::fopen(tempPath.data(), "wb");
+
+	if (!out) {
+		return false;
+	}
+
+	IndexHeader header = {};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+
+	header.entrySize = sizeof(IndexEntry);
+	header.key = key;
+
+	// Size and count are patched in once all entries are out
+	bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+
+	std::vector<IndexEntry> entries;
+	std::vector<uint8_t> record;
+
+	Thumb thumb;
+
+	while (ok && source.read(thumb) != FrameResult::END) {
+		if (entries.empty() && !thumb.pixels.empty()) {
+			header.width = (uint16_t)thumb.width;
+			header.height = (uint16_t)thumb.height;
+
+			record.resize(pixelSizeOf(thumb.width, thumb.height));
+		}
+
+		if (header.width) {
+			// The thumbnail filter scales every frame to the same size
+			ok = thumb.width == header.width && thumb.height == header.height && !thumb.pixels.empty();
+
+			if (ok) {
+				std::copy(thumb.pixels.begin(), thumb.pixels.end(), record.begin());
+				ok = std::fwrite(record.data(), record.size(), 1, out) == 1;
+			}
+		}
+
+		IndexEntry entry = {};
+
+		entry.pts = thumb.start();
+		entry.next = thumb.end();
+
+		std::memcpy(entry.bits, thumb.print.bits, sizeof(entry.bits));
+		std::memcpy(entry.mask, thumb.print.mask, sizeof(entry.mask));
+		std::memcpy(entry.coarse, thumb.print.coarse, sizeof(entry.coarse));
+
+		entries.push_back(entry);
+	}
+
+	header.count = entries.size();
+
+	ok = ok && (entries.empty() || std::fwrite(entries.data(), sizeof(IndexEntry), entries.size(), out) == entries.size());
+	ok = ok && std::fseek(out, 0, SEEK_SET) == 0;
+	ok = ok && std::fwrite(&header, sizeof(header), 1, out) == 1;
+	ok = std::fclose(out) == 0 && ok;
+
+	std::error_code error;
+
+	if (ok) {
+		std::filesystem::rename(tempPath, indexPath, error);
+	}
+
+	if (!ok || error) {
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+	HANDLE handle = CreateFileA(path.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	file = handle;
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!mapping) {
+		close();
+		return false;
+	}
+
+	view = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	length = (size_t)size.QuadPart;
+
+	if (!view) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (view) {
+		UnmapViewOfFile(view);
+	}
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	if (file) {
+		CloseHandle(file);
+	}
+
+	view = nullptr;
+	length = 0;
+
+	file = nullptr;
+	mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+	close();
+
+	int fd = ::open(path.data(), O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* ptr = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// The mapping stays valid without the descriptor
+	::close(fd);
+
+	if (ptr == MAP_FAILED) {
+		return false;
+	}
+
+	view = (const uint8_t*)ptr;
+	length = (size_t)info.st_size;
+
+	return true;
+}
+
+void MappedFile::close() {
+	if (view) {
+		munmap((void*)view, length);
+	}
+
+	view = nullptr;
+	length = 0;
+}
+
+#endif
+
+bool IndexedSource::open(const std::string& indexPath, const IndexKey& key) {
+	if (!file.open(indexPath)) {
+		return false;
+	}
+
+	IndexHeader header;
+
+	if (file.size() < sizeof(header)) {
+		return false;
+	}
+
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	const size_t recordSize = pixelSizeOf(header.width, header.height);
+
+	bool valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0
+		&& header.entrySize == sizeof(IndexEntry)
+		&& header.key == key
+		&& header.count == (file.size() - sizeof(header)) / (sizeof(IndexEntry) + recordSize)
+		&& sizeof(header) + header.count * (sizeof(IndexEntry) + recordSize) == file.size();
+
+	if (!valid) {
+		file.close();
+		return false;
+	}
+
+	count = (size_t)header.count;
+	pos = 0;
+
+	width = header.width;
+	height = header.height;
+	pixelSize = recordSize;
+
+	pixels = recordSize ? file.data() + sizeof(header) : nullptr;
+	entries = (const IndexEntry*)(file.data() + sizeof(header) + count * recordSize);
+
+	return true;
+}
+
+FrameResult IndexedSource::read(Thumb& into) {
+	if (pos >= count) {
+		return FrameResult::END;
+	}
+
+	const IndexEntry& entry = entries[pos];
+
+	if (pixels) {
+		const uint8_t* record = pixels + pos * pixelSize;
+
+		into.width = width;
+		into.height = height;
+		into.pixels.assign(record, record + (size_t)width * height);
+	} else {
+		into.width = 0;
+		into.height = 0;
+		into.pixels.clear();
+	}
+
+	pos++;
+
+	std::memcpy(into.print.bits, entry.bits, sizeof(entry.bits));
+	std::memcpy(into.print.mask, entry.mask, sizeof(entry.mask));
+	std::memcpy(into.print.coarse, entry.coarse, sizeof(entry.coarse));
+
+	into.pts = entry.pts;
+	into.next = entry.next;
+
+	return FrameResult::OK;
+}
+
+void IndexedSource::seek(int64_t pts) {
+	auto found = std::lower_bound(entries, entries + count, pts, [](const IndexEntry& entry, int64_t pts) {
+		return entry.pts < pts;
+	});
+
+	pos = found - entries;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "thumb_source.hpp"
+
+#include <cstdint>
+#include <string>
+
+/*
+	Fingerprint index of a video, so references synced against many times are
+	only decoded once.
+
+	Layout, little endian:
+
+	  IndexHeader
+	  uint8_t[count][pixelSize]    thumbnail pixels, if the header has a size
+	  IndexEntry[count]            sorted by pts
+
+	Entries and pixel records are fixed size, seeking is a binary search over
+	the mapped file. Pixels come first so they can be written as the frames
+	are decoded, the much smaller entries are held until the end. Every job
+	of a batch maps the same pages, the pixels are decoded and stored once.
+	The header records the video the index was built from (size, mtime and a
+	hash of its first and last MiB plus 64 small samples in between) and the
+	filter graph that produced the thumbnails. An index that does not match
+	both is stale.
+*/
+
+struct IndexKey {
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	uint64_t contentHash = 0;
+	uint64_t filterHash = 0;
+
+	// False if the video cannot be read
+	static bool of(const std::string& videoPath, const std::string& filterDesc, IndexKey& into);
+
+	bool operator==(const IndexKey& other) const {
+		return size == other.size && mtime == other.mtime && contentHash == other.contentHash && filterHash == other.filterHash;
+	}
+};
+
+// Index file in the temp directory for a video, named after it plus a hash
+// of its canonical path and key. Videos of the same name in different
+// directories, or a video changed since, get an index of their own.
+std::string defaultIndexPath(const std::string& videoPath, const IndexKey& key);
+
+// Drains source into an index file, written next to the target and renamed
+// over it once complete. False on I/O errors, or if a thumbnail has another
+// size than the first.
+bool writeIndex(const std::string& indexPath, const IndexKey& key, ThumbSource& source);
+
+// Read only view of a file, mapped into memory
+class MappedFile {
+	const uint8_t* view = nullptr;
+	size_t length = 0;
+
+	void* file = nullptr;
+	void* mapping = nullptr;
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	void operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	const uint8_t* data() const {
+		return view;
+	}
+	size_t size() const {
+		return length;
+	}
+};
+
+struct IndexEntry;
+
+// Serves thumbnails from an index, with the pixels they were built from
+class IndexedSource : public ThumbSource {
+	MappedFile file;
+
+	const IndexEntry* entries = nullptr;
+	size_t count = 0;
+	size_t pos = 0;
+
+	const uint8_t* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	size_t pixelSize = 0;
+
+public:
+	// False if the index is missing, damaged or does not match key
+	bool open(const std::string& indexPath, const IndexKey& key);
+
+	ffmpeg::FrameResult read(Thumb& into) override;
+	void seek(int64_t pts) override;
+};
@@ -0,0 +1,112 @@
+#include "frame_source.hpp"
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+using namespace ffmpeg;
+
+namespace {
+	void pinToCore(std::thread& thread, int core) {
+#ifdef _WIN32
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+	}
+}
+
+FrameSource::FrameSource(Video& video, const std::string& filterDesc, int core, size_t depth)
+	: video(video), filter(video, filterDesc), queue(depth), core(core) {
+	int width, height;
+
+	if (Thumbnailer::parse(filterDesc, width, height)) {
+		thumbnailer = Thumbnailer(width, height);
+	}
+}
+
+FrameSource::~FrameSource() {
+	stop();
+}
+
+void FrameSource::start() {
+	stopping = false;
+	ended = false;
+
+	worker = std::thread([this] { run(); });
+
+	if (core >= 0) {
+		pinToCore(worker, core);
+	}
+}
+
+void FrameSource::stop() {
+	if (!worker.joinable()) {
+		return;
+	}
+
+	stopping = true;
+	queue.wake();
+	worker.join();
+
+	queue.clear();
+}
+
+void FrameSource::seek(int64_t pts) {
+	stop();
+	video.seek(pts);
+
+	ended = false;
+}
+
+void FrameSource::run() {
+	MFrame frame;
+	MFrame thumb;
+
+	while (!stopping) {
+		bool more = video.readWithNext(frame) != FrameResult::END;
+
+		// Thumbnails written directly go out in their own frame, the swap
+		// hands back a consumed one to write the next into
+		MFrame* out = &frame;
+
+		// An empty frame marks the end of the stream
+		if (!more) {
+			frame.free();
+		} else if (thumbnailer.scale(frame, thumb)) {
+			out = &thumb;
+		} else {
+			filter.process(frame);
+		}
+
+		if (!queue.push(*out, stopping) || !more) {
+			return;
+		}
+	}
+}
+
+FrameResult FrameSource::read(MFrame& into) {
+	if (ended) {
+		return FrameResult::END;
+	}
+
+	// Idle sources don't decode ahead, the first read starts them
+	if (!worker.joinable()) {
+		start();
+	}
+
+	queue.pop(into);
+
+	if (!into) {
+		ended = true;
+		return FrameResult::END;
+	}
+
+	return FrameResult::OK;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ffmpeg_video.hpp"
+#include "spsc_queue.hpp"
+#include "thumbnailer.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace ffmpeg {
+
+	// Demuxes, decodes and filters a video on its own thread, ahead of the
+	// consumer. Frames are handed over through a bounded queue, so the reader
+	// only waits when it outpaces the decoder. The thread starts with the
+	// first read after construction or a seek, and sleeps while the queue is full.
+	class FrameSource {
+		Video& video;
+		VideoGraph filter;
+
+		// Takes the place of filter for plain gray thumbnails of YUV video
+		Thumbnailer thumbnailer;
+
+		SpscQueue<MFrame> queue;
+
+		std::thread worker;
+		std::atomic<bool> stopping{ false };
+
+		int core = -1;
+		bool ended = false;
+
+		void run();
+
+	public:
+		// core < 0 leaves scheduling to the OS. Only the demux/filter thread is
+		// pinned, libavcodec's own frame threads are not affected.
+		FrameSource(Video& video, const std::string& filterDesc, int core = -1, size_t depth = 64);
+		~FrameSource();
+
+		FrameSource(const FrameSource&) = delete;
+		void operator=(const FrameSource&) = delete;
+
+		void start();
+		void stop();
+
+		// Drops the queued frames, decoding resumes from pts on the next read
+		void seek(int64_t pts);
+
+		// Blocks until the next filtered frame is decoded, same contract as
+		// Video::readWithNext
+		FrameResult read(MFrame& into);
+	};
+
+}
@@ -1,17 +1,36 @@
 
 #include "ffmpeg_video.hpp"
+#include "frame_source.hpp"
+#include "frame_compare.hpp"
+#include "fingerprint.hpp"
+#include "thumb_arena.hpp"
+#include "frame_index.hpp"
+#include "thread_pool.hpp"
+#include "coarse_align.hpp"
+#include "shot_index.hpp"
+#include "packet_index.hpp"
+#include "remux.hpp"
+#include "audio_print.hpp"
+#include "matcher.hpp"
 
 #include <exception>
 #include <optional>
 #include <vector>
 #include <algorithm>
 #include <functional>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <mutex>
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 
 #include <cassert>
+#include <cstring>
+#include <limits>
 
 /*
 	Things why this is fragile AF:
@@ -20,14 +39,13 @@
 	- Does not account for timeBase != 1/1000
 	- Does not account for ref.timeBase != src.timeBase
 	- Does not account for variable frame lengths
-	- Not robust against frozen sections, edit matrix runs out of space (should coalesce eq. frames)
 	- Edit collection for last hunk is wonky
 	- No proper parameters for frame graph, tresholds
 	- Complete desync not handled
 
 	Could/should be improved:
 	- heuristics, data is usually converging
-	- proper multithreading (matrix bottleneck), pin decoders to cores
+	- proper multithreading (matrix bottleneck)
 	- matrix could be sliding, or sparse matrix structure (quadtree)
 
 	TODO:
@@ -46,389 +64,336 @@
 
 using namespace ffmpeg;
 
-double compareFrames(const MFrame& ref, const MFrame& src) {
-	if (ref->width != src->width || ref->height != src->height)
-		return 1;
-
-	const auto width = ref->width;
-	const auto height = ref->height;
+#include <thread>
 
-	uint64_t diff = 0;
+#include <windows.h>
 
-	for (auto y = 0; y < height; ++y) {
-		auto lineA = &ref->data[0][ref->linesize[0] * y];
-		auto lineB = &src->data[0][src->linesize[0] * y];
+// TODO: A proper launch param lib would be nice
+PTS resyncMatchTreshold = 10 * 1000;
 
-		for (auto x = 0; x < width; ++x) {
-			diff += std::abs(lineA[x] - lineB[x]);
-		}
-	}
+PTS verifyMatchTreshold = 5 * 1000;
+PTS verifyDriftTreshold = 100;
 
-	return (double)diff / width / height / (1LL << 8);
-}
+bool pinDecoders = false;
 
-template<typename T>
-struct Matrix2D {
+size_t matchBand = 150;
 
-	Matrix2D(size_t size = 1024 + 1) {
-		resize(size, size);
-	}
+// Frame pairs fed to the matcher at once, and threads scoring them
+int feedChunk = 8;
+unsigned matchThreads = 0;
 
-	T& at(size_t x, size_t y) {
-		return data[x + y * width];
-	}
-	const T& at(size_t x, size_t y) const {
-		return data[x + y * width];
-	}
+std::string refIndexPath;
 
-	void resize(size_t newWidth, size_t newHeight) {
-		std::vector<T> newData{ newWidth * newHeight };
+bool coarseMode = false;
+bool shotMode = false;
+bool keyframeProbes = false;
+bool packetMode = false;
 
-		for (auto y = 0; y < height; y++) {
-			for (auto x = 0; x < width; x++) {
-				newData[x + y * newWidth] = std::move(at(x, y));
-			}
-		}
+DecodeProfile decodeProfile;
+bool validateDecode = false;
 
-		data = std::move(newData);
+// Single forward pass, for pipes and files still being written
+bool streamMode = false;
 
-		width = newWidth;
-		height = newHeight;
-	}
+// Sources aligned at once in batch mode
+unsigned batchJobs = 4;
 
-private:
-	size_t width = 0;
-	size_t height = 0;
+// Checks for a single offset over the whole file before aligning
+bool offsetCheck = false;
 
-	std::vector<T> data;
-};
+// Aligns the audio first, the video only settles where its offsets change
+bool audioMode = false;
 
-enum class MKind : uint8_t {
-	None, Match, Extra, Missing
-};
+// Where the ref video and the moved src audio and subtitles are written, if anywhere
+std::string remuxPath;
 
-using Offset = uint16_t;
-using Score = int32_t;
-using PTS = int64_t;
+// Fast forward probes run at once, each on its own pair of decoders
+int probeCount = 1;
 
-struct Cell {
-	MKind kind;
+bool operator!=(const AVRational& objA, const AVRational& objB) {
+	return objA.num != objB.num || objA.den != objB.den;
+}
 
-	Offset offX;
-	Offset offY;
+const std::string thumbFilter = "format=gray,scale=96x54";
 
-	Score score;
-};
+// Empty sections at the start of a matcher come out as 0, moves them to
+// where its frames begin
+void clampStart(Match& entry, PTS refFrom, PTS srcFrom) {
+	entry.ref.start = std::max(entry.ref.start, refFrom);
+	entry.ref.end = std::max(entry.ref.end, refFrom);
+	entry.src.start = std::max(entry.src.start, srcFrom);
+	entry.src.end = std::max(entry.src.end, srcFrom);
+}
 
-struct Section {
-	PTS start;
-	PTS end;
+// Parts of src between the edits, each with the offset that puts it on
+// the ref timeline. Extra src goes, Missing ref is left as a gap.
+std::vector<ffmpeg::KeptSpan> keptSpans(const std::vector<Match>& edits) {
+	std::vector<ffmpeg::KeptSpan> spans;
 
-	PTS len() const {
-		return end - start;
-	}
-};
+	PTS refAt = 0;
+	PTS srcAt = 0;
 
-namespace {
-	struct pts_t {
-		PTS value;
-	};
+	for (auto& edit : edits) {
+		if (edit.src.start > srcAt) {
+			spans.push_back({ srcAt, edit.src.start, edit.ref.start - edit.src.start });
+		}
 
-	pts_t pts(PTS value) {
-		return { value };
+		refAt = edit.ref.end;
+		srcAt = std::max(srcAt, edit.src.end);
 	}
 
-	std::ostream& operator<<(std::ostream& out, const pts_t& obj) {
-		double value = obj.value / 1000.0;
+	spans.push_back({ srcAt, std::numeric_limits<PTS>::max(), refAt - srcAt });
 
-		int M = (int)(value / 60) % 60;
-		int S = (int)(value / 1) % 60;
-		int m = (int)(std::fmod(value, 1) * 1000);
+	return spans;
+}
 
-		out << std::setfill('0');
-		out << std::setw(2) << M << ":";
-		out << std::setw(2) << S << ".";
-		out << std::setw(3) << m;
+// Aligns one source against the reference, everything it reports goes to out
+int align(const std::string& refPath, const std::string& srcPath, std::ostream& out) {
+	Video ref{ refPath, decodeProfile };
+	Video src{ srcPath, decodeProfile };
 
-		return out;
+	if (ref.getTimeBase() != src.getTimeBase()) {
+		std::cerr << "Input files have different tbase!" << std::endl;
+		return 2;
 	}
 
-	std::ostream& operator<<(std::ostream& out, const Section& obj) {
-		if (obj.start == obj.end) {
-			out << "[" << pts(obj.start) << " / --:--.--- | --:--.---] ";
-		} else {
-			out << "[" << pts(obj.start) << " / " << pts(obj.end) << " | " << pts(obj.len()) << "] ";
-		}
-
-		return out;
+	// TODO: This assumption is hardcoded quite a lot..
+	if (ref.getTimeBase() != AVRational{1, 1000}) {
+		std::cerr << "For now only 1/1000 tbase videos are supported" << std::endl;
+		return 3;
 	}
-}
-
-struct Match {
-	MKind kind;
 
-	Section ref;
-	Section src;
+	// Demux only pass, seeks then start decoding at the right keyframe
+	PacketIndex refPackets;
+	PacketIndex srcPackets;
 
-	void print(std::ostream& out) {
-		out << ref << src;
+	if (keyframeProbes || packetMode) {
+		out << "Indexing packets" << std::endl;
 
-		switch (kind) {
-			case MKind::Match: 	 out << delta(); break;
-			case MKind::Extra:	 out << "+";     break;
-			case MKind::Missing: out << "-";     break;
-		}
-
-		out << std::endl;
-	}
+		auto srcBuild = std::async(std::launch::async, [&] { srcPackets.build(srcPath, packetMode); });
+		refPackets.build(refPath, packetMode);
+		srcBuild.get();
 
-	PTS delta() {
-		return ref.start - src.start;
+		ref.useIndex(&refPackets);
+		src.useIndex(&srcPackets);
 	}
-};
 
-class Matcher {
+	// Decodes the same stretch of ref once per decoder shortcut, and reports
+	// how far its thumbnails drift from a full quality decode
+	if (validateDecode) {
+		const size_t frames = 500;
+		const PTS from = ref.getDuration() / 2;
 
-public:
-	std::vector<MFrame> refValues;
-	std::vector<MFrame> srcValues;
+		auto sample = [&](const DecodeProfile& profile, double& seconds) {
+			auto begin = std::chrono::steady_clock::now();
 
-private:
-	Matrix2D<Cell> matrix;
+			Video video{ refPath, profile };
+			DecodedSource source{ video, thumbFilter };
 
-	size_t maxW = 0;
-	size_t maxH = 0;
+			source.seek(from);
 
-	void offer(size_t x, size_t y, MKind kind, Score score = 0) {
-		Offset offX = kind != MKind::Extra;
-		Offset offY = kind != MKind::Missing;
+			std::vector<Thumb> thumbs;
+			Thumb thumb;
 
-		auto& prev = matrix.at(x - offX, y - offY);
+			while (thumbs.size() < frames && source.read(thumb) != FrameResult::END) {
+				thumbs.push_back(std::move(thumb));
+			}
 
-		if (prev.kind == kind) {
-			offX += prev.offX;
-			offY += prev.offY;
-		}
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+			return thumbs;
+		};
 
-		score += prev.score;
+		DecodeProfile lowres;
+		lowres.lowres = 1;
 
-		auto& curr = matrix.at(x, y);
+		DecodeProfile loopFilter;
+		loopFilter.skipLoopFilter = AVDISCARD_ALL;
 
-		if (curr.kind == MKind::None || curr.score <= score) {
-			curr = { kind, offX, offY, score };
-		}
-	}
+		DecodeProfile idct;
+		idct.skipIdct = AVDISCARD_NONREF;
 
-	void calc(size_t x, size_t y) {
-		if (x != 0) {
-			offer(x, y, MKind::Missing);
-		}
-		if (y != 0) {
-			offer(x, y, MKind::Extra);
-		}
-		if (x != 0 && y != 0) {
-			auto& ref = refValues[x - 1];
-			auto& src = srcValues[y - 1];
+		DecodeProfile fast;
+		fast.fast = true;
 
-			double diff = compareFrames(ref, src);
-			Score score = lround((0.05 - diff) * 100);
+		std::vector<std::pair<const char*, DecodeProfile>> variants{
+			{ "lowres", lowres },
+			{ "skip_loop_filter", loopFilter },
+			{ "skip_idct", idct },
+			{ "flags2 fast", fast },
+			{ "all", DecodeProfile::thumbnails() },
+		};
 
-			if (matrix.at(x - 1, y - 1).kind == MKind::Match && score > 0) {
-				score += 1;
-			}
+		double baseSeconds;
+		auto base = sample({}, baseSeconds);
 
-			offer(x, y, MKind::Match, score);
-		}
-	}
+		out << std::fixed;
+		out << std::left << std::setw(18) << "full" << std::setprecision(1) << base.size() / baseSeconds << " fps" << std::endl;
 
-public:
-	void calc() {
-		const size_t matrixW = refValues.size() +1;
-		const size_t matrixH = srcValues.size() +1;
+		for (auto& [name, profile] : variants) {
+			double seconds;
+			auto thumbs = sample(profile, seconds);
 
-		for (size_t y = 0; y <= maxH; y++) {
-			for (size_t x = maxW + 1; x < matrixW; x++) {
-				calc(x, y);
-			}
-		}
-		for (size_t y = maxH + 1; y < matrixH; y++) {
-			for (size_t x = 0; x < matrixW; x++) {
-				calc(x, y);
-			}
-		}
+			double sum = 0;
+			double worst = 0;
 
-		maxW = matrixW - 1;
-		maxH = matrixH - 1;
-	}
+			size_t compared = 0;
+			size_t rejected = 0;
 
-private:
-	Match cellToMatch(size_t x, size_t y) const {
-		auto& cell = matrix.at(x, y);
+			// Frames pair up by pts, a shortcut may drop some
+			size_t j = 0;
 
-		Match result{ cell.kind };
+			for (auto& thumb : thumbs) {
+				while (j < base.size() && base[j].start() < thumb.start()) {
+					j++;
+				}
 
-		if (cell.kind == MKind::Extra) {
-			if (x > cell.offX +1ULL) {
-				auto prev = x - cell.offX -1;
-			
-				result.ref = { refValues[prev].end(), refValues[prev].end() };
-			}
-		}
-		else {
-			auto start = std::max(x - cell.offX + 1, 1ULL) - 1;
-			auto end = x - 1;
+				if (j == base.size()) {
+					break;
+				}
+				if (base[j].start() != thumb.start()) {
+					continue;
+				}
 
-			result.ref = { refValues[start].start(), refValues[end].end() };
-		}
+				double diff = compareFrames(base[j], thumb);
 
-		if (cell.kind == MKind::Missing) {
-			if (y > cell.offY +1ULL) {
-				auto prev = y - cell.offY - 1;
+				sum += diff;
+				worst = std::max(worst, diff);
 
-				result.src = { refValues[prev].end(), refValues[prev].end() };
+				compared++;
+				rejected += diff > matchTreshold;
 			}
-		} else {
-			auto start = std::max(y - cell.offY + 1, 1ULL) - 1;
-			auto end = y -1;
 
-			result.src = { srcValues[start].start(), srcValues[end].end() };
+			out << std::left << std::setw(18) << name << std::setprecision(1) << thumbs.size() / seconds << " fps";
+			out << std::setprecision(4) << "  mean " << (compared ? sum / compared : 0) << "  max " << worst;
+			out << "  over treshold " << rejected << "/" << compared << std::endl;
 		}
 
-		return result;
+		return 0;
 	}
 
-public:
-	using Visitor = std::function<void(Match)>;
+	// Both inputs decode on their own thread while the matcher works on the
+	// frames already delivered. A reference with an index is not decoded at all.
+	std::unique_ptr<ThumbSource> refThumbs;
+	std::unique_ptr<ThumbSource> srcThumbs = std::make_unique<DecodedSource>(src, thumbFilter, pinDecoders ? 1 : -1);
 
-	void trace(Visitor visitor) const {
-		auto x = maxW;
-		auto y = maxH;
+	IndexKey key;
 
-		while (x != 0 || y != 0) {
-			visitor(cellToMatch(x, y));
-
-			auto& cell = matrix.at(x, y);
-
-			assert(cell.offX || cell.offY);
-			assert(cell.offX <= x);
-			assert(cell.offY <= y);
-
-			x -= cell.offX;
-			y -= cell.offY;
+	if (!refIndexPath.empty()) {
+		if (!IndexKey::of(refPath, thumbFilter, key)) {
+			std::cerr << "Cannot read " << refPath << std::endl;
+			return 2;
 		}
-	}
-};
-
-#include <thread>
-
-#include <windows.h>
 
-// TODO: A proper launch param lib would be nice
-PTS resyncMatchTreshold = 10 * 1000;
+		auto indexed = std::make_unique<IndexedSource>();
 
-PTS verifyMatchTreshold = 5 * 1000;
-PTS verifyDriftTreshold = 100;
+		if (!indexed->open(refIndexPath, key)) {
+			out << "Building index " << refIndexPath << std::endl;
 
-bool operator!=(const AVRational& objA, const AVRational& objB) {
-	return objA.num != objB.num || objA.den != objB.den;
-}
+			DecodedSource decoded{ ref, thumbFilter, pinDecoders ? 0 : -1 };
 
-int main(int argc, char* argv[]) {
-	{
-		HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+			if (!writeIndex(refIndexPath, key, decoded) || !indexed->open(refIndexPath, key)) {
+				std::cerr << "Cannot write index " << refIndexPath << std::endl;
+				return 2;
+			}
+		}
 
-		DWORD dwMode;
-		GetConsoleMode(hOut, &dwMode);
-		SetConsoleMode(hOut, dwMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+		refThumbs = std::move(indexed);
+	} else {
+		refThumbs = std::make_unique<DecodedSource>(ref, thumbFilter, pinDecoders ? 0 : -1);
 	}
 
-	std::vector<std::string> inputs;
-
-	{
-		std::vector<std::string> args;
+	Thumb thumb;
+	
+	ThreadPool pool{ matchThreads };
 
-		for (auto i = 0; i < argc; i++) {
-			args.emplace_back(argv[i]);
-		}
+	// Feeds frames in chunks, the matcher scores a whole chunk in parallel
+	auto feed = [&](Matcher& matcher, ThumbSource& refSource, ThumbSource& srcSource) {
+		bool newFrames = false;
+		Thumb thumb;
 
-		auto lastArg = args.size() -1;
+		for (auto i = 0; i < feedChunk; i++) {
+			bool read = false;
 
-		for (auto i = 1; i <= lastArg; i++) {
-			auto& arg = args[i];
+			if (refSource.read(thumb) != FrameResult::END) {
+				read = true;
+				appendCoalesced(matcher.refValues, thumb);
+			}
+			if (srcSource.read(thumb) != FrameResult::END) {
+				read = true;
+				appendCoalesced(matcher.srcValues, thumb);
+			}
 
-			if (i != lastArg) {
-				if (arg == "--resync-match-treshold") {
-					resyncMatchTreshold = std::atol(args[++i].data());
-					continue;
-				} else if (arg == "--verify-match-treshold") {
-					verifyMatchTreshold = std::atol(args[++i].data());
-					continue;
-				} else if (arg == "--verify-drift-treshold") {
-					verifyDriftTreshold = std::atol(args[++i].data());
-					continue;
-				}
+			if (!read) {
+				break;
 			}
 
-			inputs.push_back(arg);
+			newFrames = true;
 		}
 
-		if (inputs.size() < 2) {
-			std::cerr << "Not enough input files provided" << std::endl;
-			return 2;
+		if (newFrames) {
+			matcher.calc();
 		}
-	}
 
-	auto& out = std::cout;
+		return newFrames;
+	};
 
-	Video ref{inputs[0]};
-	Video src{inputs[1]};
+	std::vector<Match> finalEdits;
+	std::optional<Match> sync;
 
-	if (ref.getTimeBase() != src.getTimeBase()) {
-		std::cerr << "Input files have different tbase!" << std::endl;
-		return 2;
-	}
+	auto finish = [&] {
+		out << std::endl;
+		out << "Final edits: " << std::endl;
 
-	// TODO: This assumption is hardcoded quite a lot..
-	if (ref.getTimeBase() != AVRational{1, 1000}) {
-		std::cerr << "For now only 1/1000 tbase videos are supported" << std::endl;
-		return 3;
-	}
+		for (auto& edit : finalEdits) {
+			edit.print(out);
+		}
 
-	VideoGraph refScaler{ ref, "format=gray,scale=96x54" };
-	VideoGraph srcScaler{ src, "format=gray,scale=96x54" };
+		if (!remuxPath.empty()) {
+			out << std::endl;
+			out << "Remuxing to " << remuxPath << std::endl;
 
-	MFrame buffer;
-	
-	auto feed = [&](Matcher& matcher) {
-		bool newFrames = false;
+			if (!remux(refPath, srcPath, keptSpans(finalEdits), remuxPath)) {
+				return 2;
+			}
+		}
 
-		if (ref.readWithNext(buffer) != FrameResult::END) {
-			newFrames = true;
+		return 0;
+	};
 
-			refScaler.process(buffer);
-			matcher.refValues.push_back(std::move(buffer));
+	// Edits for the parts of ref before src starts at delta, and after it ends
+	auto leadIn = [&](PTS delta) {
+		if (delta > 0) {
+			finalEdits.push_back({ MKind::Missing, { 0, delta }, { 0, 0 } });
+		} else if (delta < 0) {
+			finalEdits.push_back({ MKind::Extra, { 0, 0 }, { 0, -delta } });
 		}
-		if (src.readWithNext(buffer) != FrameResult::END) {
-			newFrames = true;
-
-			srcScaler.process(buffer);
-			matcher.srcValues.push_back(std::move(buffer));
+	};
+	auto leadOut = [&](PTS delta) {
+		const PTS refEnd = ref.getDuration();
+		const PTS srcEnd = src.getDuration();
+
+		if (srcEnd + delta < refEnd) {
+			finalEdits.push_back({ MKind::Missing, { srcEnd + delta, refEnd }, { srcEnd, srcEnd } });
+		} else if (srcEnd + delta > refEnd) {
+			finalEdits.push_back({ MKind::Extra, { refEnd, refEnd }, { refEnd - delta, srcEnd } });
 		}
+	};
 
-		if (newFrames) {
-			matcher.calc();
-		}
+	// Offset changes from from to to at src time at, where nothing better is known
+	auto shift = [&](PTS at, PTS from, PTS to) {
+		const PTS change = to - from;
 
-		return newFrames;
+		if (change > 0) {
+			finalEdits.push_back({ MKind::Missing, { at + from, at + to }, { at, at } });
+		} else if (change < 0) {
+			finalEdits.push_back({ MKind::Extra, { at + from, at + from }, { at, at - change } });
+		}
 	};
 
-	std::vector<Match> finalEdits;
-	std::optional<Match> sync;
-
 	auto resync = [&] {
 		sync.reset();
 
-		Matcher matcher;
+		Matcher matcher{ matchBand, &pool };
 		size_t entries = 0;
 
 		auto submit = [&](bool all) {
@@ -453,8 +418,8 @@ int main(int argc, char* argv[]) {
 			}
 		};
 
-		for (auto sample = 0; sample < 1000; sample++) {
-			if (!feed(matcher)) {
+		for (auto sample = 0; sample < 1000; sample += feedChunk) {
+			if (!feed(matcher, *refThumbs, *srcThumbs)) {
 				submit(true);
 				break;
 			}
@@ -493,11 +458,13 @@ int main(int argc, char* argv[]) {
 		return false;
 	};
 
-	auto verify = [&] {
-		Matcher matcher;
+	// The pool serves one matcher at a time, probes running side by side
+	// score on their own thread
+	auto verify = [&](ThumbSource& refSource, ThumbSource& srcSource, ThreadPool* scorer) {
+		Matcher matcher{ matchBand, scorer };
 
-		for (auto sample = 0; sample < 1000; sample++) {
-			if (!feed(matcher)) {
+		for (auto sample = 0; sample < 1000; sample += feedChunk) {
+			if (!feed(matcher, refSource, srcSource)) {
 				break;
 			}
 
@@ -524,59 +491,1114 @@ int main(int argc, char* argv[]) {
 		return true;
 	};
 	
-	PTS refEnd = ref.getDuration();
+	// Most pairs differ by nothing but a lead in. One short window of src is
+	// slid over ref for an offset, a few more spread over the file confirm
+	// it. When they do, the fix is a delay on the src tracks and the
+	// resync loop has nothing to find.
+	if (offsetCheck) {
+		// Largest lead in either way, and the src window searched for
+		const PTS maxLead = 60 * 1000;
+		const PTS window = 10 * 1000;
 
-	for (auto i = 0; i < 100; i++) {
-		out << "Resyncing" << std::endl;
-		
-		if (!resync()) {
-			break;
+		// Confirmed matches may sit a bit off when frame times don't line up
+		const PTS tolerance = 20;
+
+		auto readUntil = [&](ThumbSource& source, PTS from, PTS to) {
+			std::vector<Thumb> thumbs;
+
+			source.seek(from);
+
+			while (source.read(thumb) != FrameResult::END && thumb.start() < to) {
+				thumbs.push_back(std::move(thumb));
+			}
+
+			return thumbs;
+		};
+
+		const PTS srcAt = std::min(maxLead, src.getDuration() / 4);
+		const PTS refFrom = std::max<PTS>(0, srcAt - maxLead);
+
+		auto srcWindow = readUntil(*srcThumbs, srcAt, srcAt + window);
+		auto refWindow = readUntil(*refThumbs, refFrom, srcAt + maxLead + window);
+
+		PTS delta;
+		double agreement;
+
+		const bool decided = estimateOffset(refWindow, srcWindow, fingerprintTreshold, delta, agreement);
+
+		if (decided) {
+			out << "Offset estimate " << delta << " ms, " << int(agreement * 100) << "% of frames agree" << std::endl;
+		} else {
+			out << "Offset estimate: cannot decide, too little of ref around the src window or nothing distinct in it" << std::endl;
 		}
 
-		// Binary search for sync loss
-		Match anchor = *sync;
+		auto confirm = [&](PTS at) {
+			refThumbs->seek(at + delta);
+			srcThumbs->seek(at);
 
-		PTS min = 0;
-		PTS max = refEnd - anchor.ref.end;
+			Matcher matcher{ matchBand, &pool };
 
-		if (max - min < 2000) {
-			break;
+			for (auto sample = 0; sample < 1000; sample += feedChunk) {
+				if (!feed(matcher, *refThumbs, *srcThumbs)) {
+					break;
+				}
+
+				PTS match = 0;
+				PTS drift = 0;
+				bool moved = false;
+
+				matcher.trace([&](Match entry) {
+					if (entry.kind == MKind::Match) {
+						match += entry.ref.len();
+						moved = moved || std::abs(entry.delta() - delta) > tolerance;
+					} else {
+						drift += entry.ref.len();
+						drift += entry.src.len();
+					}
+				});
+
+				if (moved || drift > verifyDriftTreshold) {
+					return false;
+				}
+				if (match > verifyMatchTreshold) {
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		bool constant = decided && agreement >= 0.8;
+
+		for (int i = 1; constant && i <= 4; i++) {
+			const PTS at = src.getDuration() * i / 5;
+
+			if (at + delta < 0 || at + delta + verifyMatchTreshold > ref.getDuration()) {
+				continue;
+			}
+
+			constant = confirm(at);
+
+			out << "Confirm at " << pts(at) << (constant ? " holds" : " fails") << std::endl;
 		}
 
-		out << std::endl << "Fast forwarding" << std::endl;
+		if (constant) {
+			// Only the ends differ
+			leadIn(delta);
+			leadOut(delta);
 
-		while (max - min > 2000) {
-			PTS delta = (min + max) / 2;
+			out << std::endl;
+			out << "Constant offset, track delay: " << delta << " ms" << std::endl;
 
-			ref.seek(anchor.ref.end + delta);
-			src.seek(anchor.src.end + delta);
+			return finish();
+		}
 
-			out << " " << pts(anchor.ref.end + delta);
-			out << " " << pts(anchor.src.end + delta);
+		out << "No constant offset, aligning" << std::endl;
 
-			if (verify()) {
-				out << "  OK  " << sync->delta() << std::endl;
-			
-				min = delta;
-			} else {
-				out << " FAIL " << std::endl;
-			
-				max = delta;
+		refThumbs->seek(0);
+		srcThumbs->seek(0);
+	}
+
+	// Audio decodes and hashes for a fraction of what video costs. Its
+	// segments give the offsets, the matcher only looks at the few seconds
+	// around each place where they change, where the audio was silent or
+	// didn't line up.
+	if (audioMode) {
+		out << "Fingerprinting audio" << std::endl;
+
+		AudioPrints refAudio;
+		AudioPrints srcAudio;
+
+		auto srcBuild = std::async(std::launch::async, [&] { return srcAudio.build(srcPath); });
+		bool audio = refAudio.build(refPath);
+		audio = srcBuild.get() && audio;
+
+		std::vector<AudioSegment> segments;
+
+		if (audio) {
+			segments = alignAudio(refAudio, srcAudio);
+		}
+
+		for (auto& segment : segments) {
+			out << "Audio " << pts(segment.srcStart) << " - " << pts(segment.srcEnd) << " " << segment.delta << std::endl;
+		}
+
+		// Both edges of a segment are only known to a block of prints
+		const PTS margin = 3000;
+		const size_t maxFrames = 10000;
+
+		// Video edits from a's end to b's start, between the first and the
+		// last match so neither side's window edge counts
+		auto refine = [&](const AudioSegment& a, const AudioSegment& b) {
+			const PTS srcFrom = std::max<PTS>(0, a.srcEnd - margin);
+			const PTS srcTo = b.srcStart + margin;
+			const PTS refTo = srcTo + b.delta;
+
+			refThumbs->seek(srcFrom + a.delta);
+			srcThumbs->seek(srcFrom);
+
+			Matcher matcher{ matchBand, &pool };
+
+			for (size_t fed = 0; fed < maxFrames; fed += feedChunk) {
+				if (!feed(matcher, *refThumbs, *srcThumbs)) {
+					break;
+				}
+
+				auto& refValues = matcher.refValues;
+				auto& srcValues = matcher.srcValues;
+
+				if (!refValues.empty() && !srcValues.empty()
+					&& refValues[refValues.size() - 1].end() >= refTo && srcValues[srcValues.size() - 1].end() >= srcTo) {
+					break;
+				}
+			}
+
+			std::vector<Match> edits;
+			std::vector<Match> pending;
+			bool seenMatch = false;
+
+			matcher.trace([&](Match entry) {
+				if (entry.kind == MKind::Match) {
+					edits.insert(edits.end(), pending.begin(), pending.end());
+					pending.clear();
+
+					seenMatch = true;
+				} else if (seenMatch) {
+					pending.push_back(entry);
+				}
+			});
+
+			std::reverse(edits.begin(), edits.end());
+
+			return edits;
+		};
+
+		if (!segments.empty()) {
+			leadIn(segments.front().delta);
+
+			for (size_t i = 1; i < segments.size(); i++) {
+				auto& a = segments[i - 1];
+				auto& b = segments[i];
+
+				auto edits = refine(a, b);
+
+				out << "Edge at " << pts(a.srcEnd) << ", " << edits.size() << " edits from video" << std::endl;
+
+				if (!edits.empty()) {
+					finalEdits.insert(finalEdits.end(), edits.begin(), edits.end());
+					continue;
+				}
+
+				// The video saw nothing, the change goes where the audio segment before it ends
+				shift(a.srcEnd, a.delta, b.delta);
 			}
+
+			leadOut(segments.back().delta);
+
+			return finish();
 		}
 
-		ref.seek(anchor.ref.end + min);
-		src.seek(anchor.src.end + min);
+		out << "No usable audio, aligning" << std::endl;
 
-		out << std::endl;
+		refThumbs->seek(0);
+		srcThumbs->seek(0);
 	}
 
-	out << std::endl;
-	out << "Final edits: " << std::endl;
+	// Streaming, both inputs are read once front to back and never seeked.
+	// The matcher only holds a window of recent frames: once the best path
+	// is far enough behind the newest frames that later ones can't change
+	// it, its edits are final and the frames before them are dropped.
+	if (streamMode) {
+		// Frames behind the newest before the path through them is trusted
+		const size_t settleFrames = 250;
+
+		// Past this the window is cut even without a match to cut after
+		const size_t maxWindow = 8 * settleFrames;
+
+		std::deque<Thumb> refWindow;
+		std::deque<Thumb> srcWindow;
+
+		PTS refFrom = 0;
+		PTS srcFrom = 0;
+
+		auto matcher = std::make_unique<Matcher>(matchBand, &pool);
+
+		// Settled if at least settleFrames came in after it on both sides
+		auto settled = [&](const Match& entry) {
+			if (refWindow.size() <= settleFrames || srcWindow.size() <= settleFrames) {
+				return false;
+			}
+
+			return entry.ref.end <= refWindow[refWindow.size() - settleFrames].start()
+				&& entry.src.end <= srcWindow[srcWindow.size() - settleFrames].start();
+		};
+
+		bool more = true;
+
+		while (more) {
+			more = false;
+
+			for (auto i = 0; i < feedChunk; i++) {
+				if (refThumbs->read(thumb) != FrameResult::END) {
+					more = true;
+					appendCoalesced(matcher->refValues, thumb);
+					refWindow.push_back(std::move(thumb));
+				}
+				if (srcThumbs->read(thumb) != FrameResult::END) {
+					more = true;
+					appendCoalesced(matcher->srcValues, thumb);
+					srcWindow.push_back(std::move(thumb));
+				}
+			}
+
+			matcher->calc();
+
+			if (more && refWindow.size() + srcWindow.size() < 4 * settleFrames) {
+				continue;
+			}
+
+			std::vector<Match> path;
+
+			matcher->trace([&](Match entry) {
+				clampStart(entry, refFrom, srcFrom);
+				path.push_back(entry);
+			});
+
+			std::reverse(path.begin(), path.end());
+
+			// Cut after the last settled match, the matcher restarts in sync
+			// there. At the end of the input everything is settled.
+			size_t cut = 0;
+
+			for (size_t i = 0; i < path.size(); i++) {
+				if (!more || (settled(path[i]) && (path[i].kind == MKind::Match || refWindow.size() + srcWindow.size() > maxWindow))) {
+					cut = i + 1;
+				}
+			}
+
+			for (size_t i = 0; i < cut; i++) {
+				if (path[i].kind != MKind::Match) {
+					path[i].print(out);
+					finalEdits.push_back(path[i]);
+				}
+			}
+
+			PTS cutRef = cut ? path[cut - 1].ref.end : refFrom;
+			PTS cutSrc = cut ? path[cut - 1].src.end : srcFrom;
+
+			// Streams in sync are one long match, it is cut where it settles
+			if (more && cut < path.size() && path[cut].kind == MKind::Match
+				&& refWindow.size() > settleFrames && srcWindow.size() > settleFrames) {
+				const PTS delta = path[cut].delta();
+
+				PTS refLine = refWindow[refWindow.size() - settleFrames].start();
+				PTS srcLine = srcWindow[srcWindow.size() - settleFrames].start();
+
+				PTS inside = std::min(refLine, srcLine + delta);
+
+				if (inside > path[cut].ref.start) {
+					cutRef = inside;
+					cutSrc = inside - delta;
+				}
+			}
+
+			if (cutRef == refFrom && cutSrc == srcFrom) {
+				if (refWindow.size() + srcWindow.size() <= maxWindow) {
+					continue;
+				}
+
+				// Nothing lines up any more, the old frames count as changed
+				cutRef = refWindow.size() > settleFrames ? refWindow[refWindow.size() - settleFrames].start() : refFrom;
+				cutSrc = srcWindow.size() > settleFrames ? srcWindow[srcWindow.size() - settleFrames].start() : srcFrom;
+
+				Match removed{ MKind::Missing, { refFrom, cutRef }, { srcFrom, srcFrom } };
+				Match added{ MKind::Extra, { cutRef, cutRef }, { srcFrom, cutSrc } };
+
+				for (auto& edit : { removed, added }) {
+					if (edit.ref.len() > 0 || edit.src.len() > 0) {
+						Match entry = edit;
+
+						entry.print(out);
+						finalEdits.push_back(entry);
+					}
+				}
+			}
+
+			refFrom = cutRef;
+			srcFrom = cutSrc;
+
+			while (!refWindow.empty() && refWindow.front().start() < refFrom) {
+				refWindow.pop_front();
+			}
+			while (!srcWindow.empty() && srcWindow.front().start() < srcFrom) {
+				srcWindow.pop_front();
+			}
+
+			matcher = std::make_unique<Matcher>(matchBand, &pool);
+
+			for (auto& kept : refWindow) {
+				appendCoalesced(matcher->refValues, kept);
+			}
+			for (auto& kept : srcWindow) {
+				appendCoalesced(matcher->srcValues, kept);
+			}
+
+			matcher->calc();
+		}
+
+		return finish();
+	}
+
+	// Keyframe pass, tells roughly where the offset changes so only the
+	// windows around those places are decoded at full rate
+	CoarsePath coarse;
+	size_t keyframes = 0;
+
+	if (coarseMode) {
+		out << "Scanning keyframes" << std::endl;
+
+		Video refKeys{ refPath, decodeProfile };
+		Video srcKeys{ srcPath, decodeProfile };
+
+		refKeys.skipFrames(AVDISCARD_NONKEY);
+		srcKeys.skipFrames(AVDISCARD_NONKEY);
+
+		DecodedSource refSource{ refKeys, thumbFilter, pinDecoders ? 0 : -1 };
+		DecodedSource srcSource{ srcKeys, thumbFilter, pinDecoders ? 1 : -1 };
+
+		auto srcFrames = std::async(std::launch::async, [&] { return readAll(srcSource); });
+		auto refFrames = readAll(refSource);
+		auto srcKeyframes = srcFrames.get();
+
+		coarse = alignKeyframes(refFrames, srcKeyframes, fingerprintTreshold);
+		keyframes = refFrames.size() + srcKeyframes.size();
+
+		out << "Paired " << coarse.points.size() << " keyframes, tolerance " << coarse.tolerance << std::endl;
+	}
+
+	// Frames read by readSpan, and the length of one, for the decode report
+	size_t spanFrames = 0;
+	PTS frameLength = 0;
+
+	// Reads up to limit frames of [from, to), returns the starts of the frames read
+	auto readSpan = [&](ThumbSource& source, PTS from, PTS to, size_t limit, ThumbArena& into) {
+		std::vector<PTS> starts;
+
+		source.seek(from);
+
+		while (starts.size() < limit && source.read(thumb) != FrameResult::END && thumb.start() < to) {
+			starts.push_back(thumb.start());
+			appendCoalesced(into, thumb);
+
+			if (frameLength == 0) {
+				frameLength = thumb.end() - thumb.start();
+			}
+		}
+
+		spanFrames += starts.size();
+
+		return starts;
+	};
+
+	// Frame level edits of a stretch the shot or packet pass left open. Long
+	// stretches are matched a window at a time, each one cut after its last
+	// match that enough frames came in behind, like the streaming pass.
+	// Stretches whose ends are only roughly placed drop what comes before
+	// their first match (trimHead) or after their last one (trimTail).
+	auto matchSpans = [&](Section refSpan, Section srcSpan, bool trimHead = false, bool trimTail = false) {
+		const size_t spanWindow = 4000;
+		const size_t spanSettle = 250;
+
+		bool first = true;
+
+		// Edits and matches in order, so the ends can be trimmed
+		std::vector<Match> found;
+
+		auto emit = [&] {
+			size_t from = 0;
+			size_t to = found.size();
+
+			while (trimHead && from < to && found[from].kind != MKind::Match) {
+				from++;
+			}
+			while (trimTail && to > from && found[to - 1].kind != MKind::Match) {
+				to--;
+			}
+
+			for (size_t i = from; i < to; i++) {
+				if (found[i].kind != MKind::Match) {
+					finalEdits.push_back(found[i]);
+				}
+			}
+
+			return from < to;
+		};
+
+		while (true) {
+			if (refSpan.len() <= 0 || srcSpan.len() <= 0) {
+				// One side is empty, the stretch is added or removed as a whole
+				if (srcSpan.len() > 0) {
+					found.push_back({ MKind::Extra, { refSpan.start, refSpan.start }, srcSpan });
+				}
+				if (refSpan.len() > 0) {
+					found.push_back({ MKind::Missing, refSpan, { srcSpan.start, srcSpan.start } });
+				}
+
+				return emit();
+			}
+
+			if (first) {
+				out << "Matching " << refSpan << srcSpan << std::endl;
+				first = false;
+			}
+
+			Matcher matcher{ matchBand, &pool };
+
+			auto refStarts = readSpan(*refThumbs, refSpan.start, refSpan.end, spanWindow, matcher.refValues);
+			auto srcStarts = readSpan(*srcThumbs, srcSpan.start, srcSpan.end, spanWindow, matcher.srcValues);
+
+			const bool last = refStarts.size() < spanWindow && srcStarts.size() < spanWindow;
+
+			matcher.calc();
+
+			std::vector<Match> path;
+
+			matcher.trace([&](Match entry) {
+				clampStart(entry, refSpan.start, srcSpan.start);
+				path.push_back(entry);
+			});
+
+			std::reverse(path.begin(), path.end());
+
+			// Later frames can't move a match spanSettle frames behind the window end
+			auto line = [&](const std::vector<PTS>& starts, const Section& span) {
+				if (starts.size() < spanWindow) {
+					return span.end;
+				}
+
+				return starts[starts.size() - spanSettle];
+			};
+
+			const PTS refLine = line(refStarts, refSpan);
+			const PTS srcLine = line(srcStarts, srcSpan);
+
+			size_t cut = 0;
+
+			for (size_t i = 0; i < path.size(); i++) {
+				if (last || (path[i].kind == MKind::Match && path[i].ref.end <= refLine && path[i].src.end <= srcLine)) {
+					cut = i + 1;
+				}
+			}
+
+			found.insert(found.end(), path.begin(), path.begin() + cut);
+
+			if (last) {
+				return emit();
+			}
+
+			PTS cutRef = cut ? path[cut - 1].ref.end : refSpan.start;
+			PTS cutSrc = cut ? path[cut - 1].src.end : srcSpan.start;
+
+			// A stretch in sync is one long match, it is cut where it settles
+			if (cut < path.size() && path[cut].kind == MKind::Match) {
+				const PTS delta = path[cut].delta();
+				const PTS inside = std::min(refLine, srcLine + delta);
+
+				if (inside > path[cut].ref.start) {
+					cutRef = inside;
+					cutSrc = inside - delta;
+				}
+			}
+
+			if (cutRef == refSpan.start && cutSrc == srcSpan.start) {
+				// Nothing lines up in the whole window, its frames count as changed
+				cutRef = refLine;
+				cutSrc = srcLine;
+
+				found.push_back({ MKind::Missing, { refSpan.start, cutRef }, { srcSpan.start, srcSpan.start } });
+				found.push_back({ MKind::Extra, { cutRef, cutRef }, { srcSpan.start, cutSrc } });
+			}
+
+			refSpan.start = cutRef;
+			srcSpan.start = cutSrc;
+		}
+	};
+
+	// Packet pass, remuxes and partial reencodes share most of their packets.
+	// Only what lies between identical runs is decoded.
+	std::vector<PacketRun> runs;
+
+	if (packetMode) {
+		const size_t minRunPackets = 48;
+
+		runs = identicalRuns(refPackets, srcPackets, minRunPackets);
+
+		out << runs.size() << " identical packet runs" << std::endl;
+
+		// Without a single run the files were encoded apart, the stretch
+		// between runs would be both files whole
+		if (runs.empty()) {
+			out << "Nothing shared, resyncing" << std::endl;
+		}
+	}
+
+	// Edits are all made by the shot or packet pass, the resync loop below
+	// gets the files otherwise
+	const bool spansMatched = shotMode || !runs.empty();
+
+	if (!runs.empty()) {
+		PTS refAt = 0;
+		PTS srcAt = 0;
+
+		for (auto& run : runs) {
+			matchSpans({ refAt, run.refStart }, { srcAt, run.srcStart });
+
+			refAt = run.refEnd;
+			srcAt = run.srcEnd;
+		}
+
+		matchSpans({ refAt, ref.getDuration() }, { srcAt, src.getDuration() });
+	} else if (shotMode) {
+		// Shot pass, pairs up the shots of both files and leaves the frame
+		// matcher only the stretches where they disagree. Cuts need every
+		// frame, this reads both sources whole before any matching, and the
+		// stretches that disagree are decoded a second time.
+		out << "Detecting shots" << std::endl;
+
+		ShotOptions options;
+		options.matchBits = fingerprintTreshold;
+
+		auto srcDetect = std::async(std::launch::async, [&] { return detectShots(*srcThumbs, options); });
+		auto refShots = detectShots(*refThumbs, options);
+		auto srcShots = srcDetect.get();
+
+		auto pairs = alignShots(refShots, srcShots, options);
+
+		out << refShots.size() << " ref shots, " << srcShots.size() << " src shots" << std::endl;
+
+		// Same frame count and length, the cuts line up exactly
+		auto clean = [&](const ShotPair& pair) {
+			if (pair.ref < 0 || pair.src < 0) {
+				return false;
+			}
+
+			auto& refShot = refShots[pair.ref];
+			auto& srcShot = srcShots[pair.src];
+
+			return refShot.frames == srcShot.frames && std::abs(refShot.len() - srcShot.len()) < refShot.len() / refShot.frames;
+		};
+
+		PTS refAt = 0;
+		PTS srcAt = 0;
+
+		for (size_t i = 0; i < pairs.size();) {
+			if (clean(pairs[i])) {
+				refAt = refShots[pairs[i].ref].end;
+				srcAt = srcShots[pairs[i].src].end;
+				i++;
+				continue;
+			}
+
+			// Run of shots that did not pair up cleanly
+			Section refSpan{ refAt, refAt };
+			Section srcSpan{ srcAt, srcAt };
+
+			for (; i < pairs.size() && !clean(pairs[i]); i++) {
+				if (pairs[i].ref >= 0) {
+					refSpan.end = refShots[pairs[i].ref].end;
+				}
+				if (pairs[i].src >= 0) {
+					srcSpan.end = srcShots[pairs[i].src].end;
+				}
+			}
+
+			matchSpans(refSpan, srcSpan);
+
+			refAt = refSpan.end;
+			srcAt = srcSpan.end;
+		}
+	}
+
+	// Coarse windows. The offset is taken to hold between the places where the
+	// keyframes say it changes, the decoders seek from one such place to the
+	// next and decode only the GOPs around it, and the ends of the files.
+	auto coarseSegments = coarse.segments();
+
+	if (coarseMode && !spansMatched && !coarseSegments.empty()) {
+		const PTS slack = coarse.tolerance;
+
+		const PTS refEnd = ref.getDuration();
+		const PTS srcEnd = src.getDuration();
+
+		// Src stretch around an offset change at src time at, from deltaFrom
+		// to deltaTo. Ref gets slack on both sides as the offsets are rough.
+		struct Window {
+			Section src;
+			Section ref;
+
+			PTS at;
+			PTS deltaFrom;
+			PTS deltaTo;
+
+			bool trimHead;
+			bool trimTail;
+		};
+
+		std::vector<Window> windows;
+
+		auto add = [&](Window window) {
+			window.src.start = std::max<PTS>(0, window.src.start);
+			window.ref.start = std::max<PTS>(0, window.ref.start);
+			window.src.end = std::min(srcEnd, window.src.end);
+			window.ref.end = std::min(refEnd, window.ref.end);
+
+			// Short segments leave no room between the windows around them
+			if (!windows.empty() && (window.src.start <= windows.back().src.end || window.ref.start <= windows.back().ref.end)) {
+				auto& last = windows.back();
+
+				last.src.end = window.src.end;
+				last.ref.end = std::max(last.ref.end, window.ref.end);
+				last.deltaTo = window.deltaTo;
+				last.trimTail = window.trimTail;
+
+				return;
+			}
+
+			windows.push_back(window);
+		};
+
+		auto& head = coarseSegments.front();
+		auto& tail = coarseSegments.back();
+
+		add({ { 0, head.first.src + slack }, { 0, head.first.src + slack + head.delta() + slack }, 0, 0, head.delta(), false, true });
+
+		for (size_t i = 1; i < coarseSegments.size(); i++) {
+			auto& a = coarseSegments[i - 1];
+			auto& b = coarseSegments[i];
+
+			const PTS srcFrom = a.last.src - slack;
+			const PTS srcTo = b.first.src + slack;
+
+			add({ { srcFrom, srcTo }, { srcFrom + a.delta() - slack, srcTo + b.delta() + slack }, a.last.src, a.delta(), b.delta(), true, true });
+		}
+
+		add({ { tail.last.src - slack, srcEnd }, { tail.last.src - slack + tail.delta() - slack, refEnd }, srcEnd, tail.delta(), refEnd - srcEnd, true, false });
+
+		for (auto& window : windows) {
+			if (matchSpans(window.ref, window.src, window.trimHead, window.trimTail)) {
+				continue;
+			}
+
+			// Nothing in the window lines up, the change goes where the offset was last seen
+			if (!window.trimTail) {
+				leadOut(window.deltaFrom);
+			} else {
+				shift(window.at, window.deltaFrom, window.deltaTo);
+			}
+		}
+
+		// What the keyframe pass saved, against decoding both files whole
+		if (frameLength > 0) {
+			const size_t whole = size_t((refEnd + srcEnd) / frameLength);
+
+			out << "Decoded " << keyframes << " keyframes and " << spanFrames << " frames in " << windows.size() << " windows";
+			out << ", about " << (keyframes + spanFrames) * 100 / std::max<size_t>(1, whole) << "% of the " << whole << " frames of both files" << std::endl;
+		}
+
+		return finish();
+	}
+
+	// Extra decoders for probing several offsets at once, the first probe of
+	// a round runs on the main ones
+	struct Prober {
+		Video ref;
+		Video src;
+
+		std::unique_ptr<ThumbSource> refThumbs;
+		std::unique_ptr<ThumbSource> srcThumbs;
+
+		Prober(const std::string& refPath, const std::string& srcPath) : ref(refPath, decodeProfile), src(srcPath, decodeProfile) {
+		}
+	};
+
+	std::vector<std::unique_ptr<Prober>> probers;
+
+	for (auto i = 1; i < probeCount && !spansMatched; i++) {
+		auto prober = std::make_unique<Prober>(refPath, srcPath);
+
+		if (keyframeProbes) {
+			prober->ref.useIndex(&refPackets);
+			prober->src.useIndex(&srcPackets);
+		}
+
+		if (!refIndexPath.empty()) {
+			auto indexed = std::make_unique<IndexedSource>();
+
+			if (!indexed->open(refIndexPath, key)) {
+				std::cerr << "Cannot read index " << refIndexPath << std::endl;
+				return 2;
+			}
+
+			prober->refThumbs = std::move(indexed);
+		} else {
+			prober->refThumbs = std::make_unique<DecodedSource>(prober->ref, thumbFilter);
+		}
+
+		prober->srcThumbs = std::make_unique<DecodedSource>(prober->src, thumbFilter);
+
+		probers.push_back(std::move(prober));
+	}
+
+	PTS refEnd = ref.getDuration();
+
+	for (auto i = 0; !spansMatched && i < 100; i++) {
+		out << "Resyncing" << std::endl;
+		
+		if (!resync()) {
+			break;
+		}
+
+		// Binary search for sync loss
+		Match anchor = *sync;
+
+		PTS min = 0;
+		PTS max = refEnd - anchor.ref.end;
+
+		if (max - min < 2000) {
+			break;
+		}
+
+		out << std::endl << "Fast forwarding" << std::endl;
+
+		// Moves a probe onto a src keyframe at most slack away, the verify run
+		// then has nothing to decode before it
+		auto snap = [&](PTS delta, PTS slack) {
+			if (srcPackets.empty()) {
+				return delta;
+			}
+
+			PTS from = std::max(min + 1, delta - slack);
+			PTS to = std::min(max - 1, delta + slack);
+
+			auto key = srcPackets.keyframeNear(anchor.src.end + delta, anchor.src.end + from, anchor.src.end + to);
+
+			return key ? key->pts - anchor.src.end : delta;
+		};
+
+		// Verifies up to one offset per decoder pair at once, then narrows the
+		// window to the first one that fails
+		auto probe = [&](std::vector<PTS> deltas) {
+			std::sort(deltas.begin(), deltas.end());
+
+			for (size_t next = 0; next < deltas.size();) {
+				std::vector<PTS> round;
+
+				for (; next < deltas.size() && round.size() <= probers.size(); next++) {
+					if (deltas[next] > min && deltas[next] < max) {
+						round.push_back(deltas[next]);
+					}
+				}
+
+				std::vector<char> passed(round.size());
+
+				auto run = [&](size_t i, ThumbSource& refSource, ThumbSource& srcSource, ThreadPool* scorer) {
+					refSource.seek(anchor.ref.end + round[i]);
+					srcSource.seek(anchor.src.end + round[i]);
+
+					passed[i] = verify(refSource, srcSource, scorer);
+				};
+
+				std::vector<std::future<void>> running;
+
+				for (size_t i = 1; i < round.size(); i++) {
+					auto& prober = *probers[i - 1];
+
+					running.push_back(std::async(std::launch::async, [&, i] {
+						run(i, *prober.refThumbs, *prober.srcThumbs, nullptr);
+					}));
+				}
+
+				if (!round.empty()) {
+					run(0, *refThumbs, *srcThumbs, &pool);
+				}
+
+				for (auto& probe : running) {
+					probe.get();
+				}
+
+				for (size_t i = 0; i < round.size(); i++) {
+					out << " " << pts(anchor.ref.end + round[i]);
+					out << " " << pts(anchor.src.end + round[i]);
+
+					if (passed[i]) {
+						out << "  OK  " << sync->delta() << std::endl;
+					} else {
+						out << " FAIL " << std::endl;
+					}
+
+					// Past the first failure the window is already closed
+					if (round[i] < max) {
+						if (passed[i]) {
+							min = round[i];
+						} else {
+							max = round[i];
+						}
+					}
+				}
+			}
+		};
+
+		// k probes split the window into k + 1 parts per round
+		while (max - min > 2000) {
+			const PTS step = (max - min) / (probers.size() + 2);
+
+			std::vector<PTS> deltas;
+
+			for (size_t i = 1; i <= probers.size() + 1; i++) {
+				deltas.push_back(snap(min + step * i, step / 4));
+			}
+
+			probe(deltas);
+		}
+
+		refThumbs->seek(anchor.ref.end + min);
+		srcThumbs->seek(anchor.src.end + min);
+
+		out << std::endl;
+	}
+
+	return finish();
+}
+
+// One reference, many sources. The reference is decoded once into an index
+// that every job maps read only, pixels included, so each job compares the
+// same thumbnails a single run would. The sources are aligned side by side.
+int alignBatch(const std::vector<std::string>& inputs) {
+	auto& out = std::cout;
+
+	const std::string& refPath = inputs[0];
+
+	IndexKey key;
+
+	if (!IndexKey::of(refPath, thumbFilter, key)) {
+		std::cerr << "Cannot read " << refPath << std::endl;
+		return 2;
+	}
+
+	if (refIndexPath.empty()) {
+		refIndexPath = defaultIndexPath(refPath, key);
+	}
+
+	IndexedSource existing;
+
+	if (!existing.open(refIndexPath, key)) {
+		out << "Building index " << refIndexPath << std::endl;
+
+		Video ref{ refPath, decodeProfile };
+		DecodedSource decoded{ ref, thumbFilter };
+
+		if (!writeIndex(refIndexPath, key, decoded)) {
+			std::cerr << "Cannot write index " << refIndexPath << std::endl;
+			return 2;
+		}
+	}
+
+	// The jobs keep the cores busy, each scores on its own thread unless
+	// told otherwise. Pinning every job to the same two cores would not help.
+	pinDecoders = false;
+
+	if (matchThreads == 0) {
+		matchThreads = 1;
+	}
+
+	std::mutex printing;
+	std::vector<int> results(inputs.size() - 1);
+
+	ThreadPool jobs{ batchJobs };
+
+	jobs.run(results.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			std::ostringstream buffer;
+
+			results[i] = align(refPath, inputs[i + 1], buffer);
+
+			std::lock_guard<std::mutex> lock(printing);
+			out << "== " << inputs[i + 1] << std::endl << buffer.str() << std::endl;
+		}
+	});
+
+	return *std::max_element(results.begin(), results.end());
+}
+
+void printUsage(std::ostream& out) {
+	out << "Usage: ffmpeg_sync [options] <ref> <src> [<src>...]" << std::endl;
+	out << std::endl;
+	out << "  -                          read the input from stdin" << std::endl;
+	out << "  --stream                   one forward pass, for pipes and growing files" << std::endl;
+	out << "  --constant-offset          look for a single offset over the whole file first" << std::endl;
+	out << "  --audio                    align audio fingerprints first, video only at their edges" << std::endl;
+	out << "  --coarse                   decode keyframes of both files, then only the GOPs" << std::endl;
+	out << "                             around the places where their offset changes" << std::endl;
+	out << "  --shots                    pair up shots, match only the ones that differ. Finding" << std::endl;
+	out << "                             the cuts decodes both files whole, and the stretches" << std::endl;
+	out << "                             around shots that differ are decoded again. With" << std::endl;
+	out << "                             --ref-index the ref side is read from the index." << std::endl;
+	out << "  --packet-hash              skip stretches of byte identical packets" << std::endl;
+	out << "  --keyframe-probes          seek through a demux-only keyframe index" << std::endl;
+	out << "  --ref-index <file>         fingerprint index of ref, built on first use. Batches" << std::endl;
+	out << "                             keep one in the temp directory unless given" << std::endl;
+	out << "  --remux <file>             write ref video with the moved src audio and subtitles" << std::endl;
+	out << "  --probes <n>               fast forward offsets probed at once" << std::endl;
+	out << "  --batch-jobs <n>           sources aligned at once with several sources" << std::endl;
+	out << "  --fast-decode              decoder shortcuts for thumbnails" << std::endl;
+	out << "  --validate-decode          report how far the shortcuts drift, then exit" << std::endl;
+	out << "  --pin-decoders             pin the decoder threads to their own cores" << std::endl;
+	out << "  --match-band <frames>      drift off the diagonal the matcher follows" << std::endl;
+	out << "  --match-threads <n>        threads scoring frame pairs, 0 for all" << std::endl;
+	out << "  --feed-chunk <frames>      frames fed to the matcher at once" << std::endl;
+	out << "  --freeze-treshold <diff>   frames closer than this are one frozen run, 0 turns it off" << std::endl;
+	out << "  --fingerprint-treshold <bits>" << std::endl;
+	out << "  --resync-match-treshold <ms>" << std::endl;
+	out << "  --verify-match-treshold <ms>" << std::endl;
+	out << "  --verify-drift-treshold <ms>" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	{
+		HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+
+		DWORD dwMode;
+		GetConsoleMode(hOut, &dwMode);
+		SetConsoleMode(hOut, dwMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+	}
+
+	std::vector<std::string> inputs;
+
+	{
+		std::vector<std::string> args;
+
+		for (auto i = 0; i < argc; i++) {
+			args.emplace_back(argv[i]);
+		}
+
+		auto lastArg = args.size() -1;
+
+		for (auto i = 1; i <= lastArg; i++) {
+			auto& arg = args[i];
+
+			if (i != lastArg) {
+				if (arg == "--resync-match-treshold") {
+					resyncMatchTreshold = std::atol(args[++i].data());
+					continue;
+				} else if (arg == "--verify-match-treshold") {
+					verifyMatchTreshold = std::atol(args[++i].data());
+					continue;
+				} else if (arg == "--verify-drift-treshold") {
+					verifyDriftTreshold = std::atol(args[++i].data());
+					continue;
+				} else if (arg == "--freeze-treshold") {
+					freezeTreshold = std::atof(args[++i].data());
+					continue;
+				} else if (arg == "--fingerprint-treshold") {
+					fingerprintTreshold = std::atoi(args[++i].data());
+					continue;
+				} else if (arg == "--feed-chunk") {
+					feedChunk = std::max(1, std::atoi(args[++i].data()));
+					continue;
+				} else if (arg == "--match-threads") {
+					matchThreads = std::atoi(args[++i].data());
+					continue;
+				} else if (arg == "--match-band") {
+					matchBand = std::atol(args[++i].data());
+					continue;
+				} else if (arg == "--probes") {
+					probeCount = std::max(1, std::atoi(args[++i].data()));
+					continue;
+				} else if (arg == "--batch-jobs") {
+					batchJobs = std::max(1, std::atoi(args[++i].data()));
+					continue;
+				} else if (arg == "--remux") {
+					remuxPath = args[++i];
+					continue;
+				} else if (arg == "--ref-index") {
+					refIndexPath = args[++i];
+					continue;
+				}
+			}
+
+			if (arg == "--pin-decoders") {
+				pinDecoders = true;
+				continue;
+			} else if (arg == "--coarse") {
+				coarseMode = true;
+				continue;
+			} else if (arg == "--shots") {
+				shotMode = true;
+				continue;
+			} else if (arg == "--keyframe-probes") {
+				keyframeProbes = true;
+				continue;
+			} else if (arg == "--packet-hash") {
+				packetMode = true;
+				continue;
+			} else if (arg == "--fast-decode") {
+				decodeProfile = DecodeProfile::thumbnails();
+				continue;
+			} else if (arg == "--validate-decode") {
+				validateDecode = true;
+				continue;
+			} else if (arg == "--stream") {
+				streamMode = true;
+				continue;
+			} else if (arg == "--constant-offset") {
+				offsetCheck = true;
+				continue;
+			} else if (arg == "--audio") {
+				audioMode = true;
+				continue;
+			} else if (arg == "--help") {
+				printUsage(std::cout);
+				return 0;
+			}
+
+			// Read from stdin
+			if (arg == "-") {
+				inputs.push_back("pipe:0");
+				continue;
+			}
+
+			inputs.push_back(arg);
+		}
+
+		if (inputs.size() < 2) {
+			std::cerr << "Not enough input files provided" << std::endl;
+			printUsage(std::cerr);
+			return 2;
+		}
+	}
+
+	// Each of these reads the inputs before the streaming pass would, a
+	// pipe can't be read twice. A batch aligns ref against every source.
+	if (streamMode && (keyframeProbes || packetMode || !refIndexPath.empty() || audioMode || offsetCheck || inputs.size() > 2)) {
+		std::cerr << "--keyframe-probes, --packet-hash, --ref-index, --audio, --constant-offset and several sources can't be used with --stream" << std::endl;
+		return 2;
+	}
+
+	// Each of these decodes ref again in every job, only the thumbnails
+	// are shared through the index
+	if (inputs.size() > 2 && (shotMode || coarseMode || offsetCheck || audioMode || validateDecode)) {
+		std::cerr << "--shots, --coarse, --constant-offset, --audio and --validate-decode can't be used with several sources" << std::endl;
+		return 2;
+	}
+
+	if (!remuxPath.empty() && (streamMode || inputs.size() != 2)) {
+		std::cerr << "Remuxing needs one source read from a file" << std::endl;
+		return 2;
+	}
 
-	for (auto& edit : finalEdits) {
-		edit.print(out);
+	if (inputs.size() == 2) {
+		return align(inputs[0], inputs[1], std::cout);
 	}
 
-	return 0;
+	return alignBatch(inputs);
 }
@@ -0,0 +1,463 @@
+#include "matcher.hpp"
+
+#include "frame_compare.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+int fingerprintTreshold = 48;
+
+double freezeTreshold = 0.005;
+
+namespace {
+	// Rows without a better score before the path counts as lost
+	const size_t kStallRows = 32;
+
+	// Cells the widened rows of one stall may take, 256 MiB. The band stops
+	// doubling before the rows since the last gain would need more.
+	const size_t kWideCells = size_t(1) << 24;
+
+	// A row of the default band is ~300 cells, scored in far less time than
+	// it takes to wake the pool. Only the batches of catching up rows, or
+	// of widened rows, are worth splitting.
+	const size_t kParallelCells = 4096;
+	const size_t kParallelGrain = 512;
+}
+
+double compareFrames(const ThumbRef& ref, const ThumbRef& src, double limit) {
+	if (ref.width != src.width || ref.height != src.height)
+		return 1;
+
+	const auto width = ref.width;
+	const auto height = ref.height;
+
+	const double scale = (double)width * height * (1LL << 8);
+
+	uint64_t diff = sumAbsDiff(
+		ref.pixels, width,
+		src.pixels, width,
+		width, height, (uint64_t)(limit * scale)
+	);
+
+	return diff / scale;
+}
+
+void appendCoalesced(ThumbArena& values, const Thumb& thumb) {
+	if (!values.empty() && freezeTreshold > 0) {
+		auto last = values[values.size() - 1];
+		bool same;
+
+		// Flat frames are close to every print, without pixels only an exact copy counts
+		if (last.pixels && !thumb.pixels.empty()) {
+			same = compareFrames(last, thumb, freezeTreshold) <= freezeTreshold;
+		} else {
+			same = std::memcmp(&last.print, &thumb.print, sizeof(Fingerprint)) == 0;
+		}
+
+		if (same) {
+			values.extendBack(thumb.end());
+			return;
+		}
+	}
+
+	values.push_back(thumb);
+}
+
+std::ostream& operator<<(std::ostream& out, const pts_t& obj) {
+	double value = obj.value / 1000.0;
+
+	int M = (int)(value / 60) % 60;
+	int S = (int)(value / 1) % 60;
+	int m = (int)(std::fmod(value, 1) * 1000);
+
+	out << std::setfill('0');
+	out << std::setw(2) << M << ":";
+	out << std::setw(2) << S << ".";
+	out << std::setw(3) << m;
+
+	return out;
+}
+
+std::ostream& operator<<(std::ostream& out, const Section& obj) {
+	if (obj.start == obj.end) {
+		out << "[" << pts(obj.start) << " / --:--.--- | --:--.---] ";
+	} else {
+		out << "[" << pts(obj.start) << " / " << pts(obj.end) << " | " << pts(obj.len()) << "] ";
+	}
+
+	return out;
+}
+
+void Match::print(std::ostream& out) {
+	out << ref << src;
+
+	switch (kind) {
+		case MKind::Match: 	 out << delta(); break;
+		case MKind::Extra:	 out << "+";     break;
+		case MKind::Missing: out << "-";     break;
+	}
+
+	out << std::endl;
+}
+
+// Cells outside the band, or inside but not reachable from the origin
+const Cell* Matcher::reached(size_t x, size_t y) const {
+	auto cell = matrix.find(x, y);
+
+	if (!cell || (cell->kind == MKind::None && (x != 0 || y != 0))) {
+		return nullptr;
+	}
+
+	return cell;
+}
+
+void Matcher::offer(size_t x, size_t y, MKind kind, Score score) {
+	Offset offX = kind != MKind::Extra;
+	Offset offY = kind != MKind::Missing;
+
+	auto found = reached(x - offX, y - offY);
+
+	if (!found) {
+		return;
+	}
+
+	auto& prev = *found;
+
+	if (prev.kind == kind) {
+		offX += prev.offX;
+		offY += prev.offY;
+	}
+
+	score += prev.score;
+
+	auto& curr = matrix.at(x, y);
+
+	if (curr.kind == MKind::None || curr.score <= score) {
+		curr = { kind, offX, offY, score };
+	}
+}
+
+Score Matcher::matchScore(size_t x, size_t y) const {
+	auto ref = refValues[x - 1];
+	auto src = srcValues[y - 1];
+
+	// Anything past rejectTreshold scores negative, and a negative
+	// match never beats the Missing/Extra paths around it. Prints
+	// this far apart are taken as rejected without looking at pixels.
+	int bits = distance(ref.print, src.print);
+	double diff;
+
+	if (bits > fingerprintTreshold) {
+		diff = 1;
+	} else if (!ref.pixels || !src.pixels) {
+		// Flat frames are 0 bits from each other, black and white alike
+		diff = std::max(bits * fingerprintDiffPerBit, coarseDiff(ref.print, src.print));
+	} else {
+		diff = compareFrames(ref, src, rejectTreshold);
+	}
+
+	// A pair of frozen runs counts for as many frames as they share
+	return lround((matchTreshold - diff) * 100) * Score(std::min(ref.frames, src.frames));
+}
+
+void Matcher::calc(const Pending& cell) {
+	const size_t x = cell.x;
+	const size_t y = cell.y;
+
+	if (x != 0) {
+		offer(x, y, MKind::Missing);
+	}
+	if (y != 0) {
+		offer(x, y, MKind::Extra);
+	}
+	if (cell.compare && reached(x - 1, y - 1)) {
+		Score score = cell.score;
+
+		if (reached(x - 1, y - 1)->kind == MKind::Match && score > 0) {
+			score += 1;
+		}
+
+		offer(x, y, MKind::Match, score);
+	}
+}
+
+void Matcher::queue(size_t x, size_t y) {
+	matrix.extend(y);
+
+	// The diagonal neighbour is allocated by now if it is in the band
+	bool compare = x != 0 && y != 0 && matrix.find(x - 1, y - 1);
+
+	pending.push_back({ x, y, compare, 0 });
+}
+
+void Matcher::flush() {
+	auto score = [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			auto& cell = pending[i];
+
+			if (cell.compare) {
+				cell.score = matchScore(cell.x, cell.y);
+			}
+		}
+	};
+
+	if (pool && pending.size() >= kParallelCells) {
+		pool->run(pending.size(), kParallelGrain, score);
+	} else {
+		score(0, pending.size());
+	}
+
+	for (auto& cell : pending) {
+		calc(cell);
+	}
+
+	pending.clear();
+}
+
+size_t Matcher::bestColumn(size_t y) const {
+	size_t best = matrix.lo(y);
+	const Cell* bestCell = nullptr;
+
+	for (size_t x = matrix.lo(y); x < matrix.end(y); x++) {
+		auto cell = reached(x, y);
+
+		if (cell && (!bestCell || cell->score > bestCell->score)) {
+			best = x;
+			bestCell = cell;
+		}
+	}
+
+	return best;
+}
+
+size_t Matcher::bandStart(size_t y) const {
+	if (y == 0) {
+		return 0;
+	}
+
+	const size_t center = bestColumn(y - 1) + 1;
+	const size_t lo = center > band ? center - band : 0;
+
+	return std::max(lo, matrix.lo(y - 1));
+}
+
+size_t Matcher::rowWidth() const {
+	return (2 * band + 1) << widenings;
+}
+
+bool Matcher::canWiden() const {
+	// The rows are checked again after kStallRows more of them
+	const size_t rows = kStallRows * (widenings + 2);
+
+	return (2 * band + 1) * rows << (widenings + 1) <= kWideCells;
+}
+
+bool Matcher::ready(size_t y) const {
+	return matrix.end(y) == matrix.limit(y) || matrix.end(y) > bestColumn(y) + band;
+}
+
+// A deletion in src is a horizontal run in one row, and a run longer than
+// the band leaves the path outside the windows of the rows after it. When
+// the score stops rising the rows since the last gain are placed again,
+// each time twice as wide, as far as kWideCells allows. Past that the path
+// is taken as lost and goes on from its best cell in a band of the default
+// width.
+bool Matcher::checkStall(size_t y) {
+	auto cell = reached(bestColumn(y - 1), y - 1);
+
+	if (cell && cell->score > gainScore) {
+		gainRow = y - 1;
+		gainScore = cell->score;
+		widenings = 0;
+
+		return true;
+	}
+
+	if (y - 1 - gainRow < kStallRows * (widenings + 1)) {
+		return true;
+	}
+
+	if (!canWiden()) {
+		gainRow = y - 1;
+		gainScore = cell ? cell->score : gainScore;
+		widenings = 0;
+
+		return true;
+	}
+
+	widenings++;
+
+	matrix.truncate(gainRow + 1);
+	matrix.widen(gainRow, std::max(rowWidth(), matrix.limit(gainRow) - matrix.lo(gainRow)));
+
+	firstOpen = std::min(firstOpen, gainRow);
+	settledRows = gainRow + 1;
+
+	return false;
+}
+
+void Matcher::frontier(size_t& x, size_t& y) const {
+	y = maxH;
+
+	while (y > 0 && matrix.lo(y) > maxW) {
+		y--;
+	}
+
+	x = std::min(maxW, matrix.end(y) - 1);
+
+	while (x > matrix.lo(y) && !reached(x, y)) {
+		x--;
+	}
+}
+
+void Matcher::fill() {
+	const size_t matrixW = refValues.size() +1;
+	const size_t matrixH = srcValues.size() +1;
+
+	for (size_t y = firstOpen; y < matrixH; y++) {
+		// Placing a row needs the one above it filled
+		if (y == matrix.height()) {
+			flush();
+			matrix.addRow(bandStart(y), rowWidth(), 2 * band + 1);
+		}
+
+		const size_t end = std::min(matrix.limit(y), matrixW);
+
+		for (size_t x = matrix.end(y); x < end; x++) {
+			queue(x, y);
+		}
+
+		if (y == firstOpen && matrix.end(y) == matrix.limit(y)) {
+			firstOpen++;
+		}
+	}
+
+	flush();
+}
+
+void Matcher::calc() {
+	fill();
+
+	// Src runs ahead of ref after a deletion, rows are placed long before
+	// the frames that tell where their path goes come in
+	while (settledRows < matrix.height() && ready(settledRows - 1)) {
+		const size_t y = settledRows;
+
+		if (!checkStall(y)) {
+			fill();
+			continue;
+		}
+
+		if (matrix.lo(y) != bandStart(y) || matrix.limit(y) - matrix.lo(y) != rowWidth()) {
+			matrix.truncate(y);
+			firstOpen = std::min(firstOpen, y);
+
+			fill();
+		}
+
+		settledRows++;
+	}
+
+	maxW = refValues.size();
+	maxH = srcValues.size();
+}
+
+Match Matcher::cellToMatch(size_t x, size_t y) const {
+	auto& cell = matrix.at(x, y);
+
+	Match result{ cell.kind };
+
+	if (cell.kind == MKind::Extra) {
+		if (x > cell.offX +1ULL) {
+			auto prev = x - cell.offX -1;
+
+			result.ref = { refValues[prev].end(), refValues[prev].end() };
+		}
+	}
+	else {
+		auto start = std::max(x - cell.offX + 1, 1ULL) - 1;
+		auto end = x - 1;
+
+		result.ref = { refValues[start].start(), refValues[end].end() };
+	}
+
+	if (cell.kind == MKind::Missing) {
+		if (y > cell.offY +1ULL) {
+			auto prev = y - cell.offY - 1;
+
+			result.src = { srcValues[prev].end(), srcValues[prev].end() };
+		}
+	} else {
+		auto start = std::max(y - cell.offY + 1, 1ULL) - 1;
+		auto end = y -1;
+
+		result.src = { srcValues[start].start(), srcValues[end].end() };
+	}
+
+	return result;
+}
+
+void Matcher::visitMatch(const Match& entry, size_t x, size_t y, const Visitor& visitor) const {
+	const size_t length = matrix.at(x, y).offX;
+
+	PTS refEnd = entry.ref.end;
+	PTS srcEnd = entry.src.end;
+
+	for (size_t k = 1; k <= length; k++) {
+		auto ref = refValues[x - k];
+		auto src = srcValues[y - k];
+
+		if (ref.frames == src.frames) {
+			continue;
+		}
+
+		if (ref.end() < refEnd) {
+			visitor({ MKind::Match, { ref.end(), refEnd }, { src.end(), srcEnd } });
+		}
+
+		if (ref.frames > src.frames) {
+			const PTS cut = ref.start() + (src.end() - src.start());
+
+			visitor({ MKind::Missing, { cut, ref.end() }, { src.end(), src.end() } });
+
+			refEnd = cut;
+			srcEnd = src.end();
+		} else {
+			const PTS cut = src.start() + (ref.end() - ref.start());
+
+			visitor({ MKind::Extra, { ref.end(), ref.end() }, { cut, src.end() } });
+
+			refEnd = ref.end();
+			srcEnd = cut;
+		}
+	}
+
+	visitor({ MKind::Match, { entry.ref.start, refEnd }, { entry.src.start, srcEnd } });
+}
+
+void Matcher::trace(Visitor visitor) const {
+	size_t x, y;
+	frontier(x, y);
+
+	while (x != 0 || y != 0) {
+		auto& cell = matrix.at(x, y);
+
+		Match entry = cellToMatch(x, y);
+
+		if (entry.kind == MKind::Match) {
+			visitMatch(entry, x, y, visitor);
+		} else {
+			visitor(entry);
+		}
+
+		assert(cell.offX || cell.offY);
+		assert(cell.offX <= x);
+		assert(cell.offY <= y);
+
+		x -= cell.offX;
+		y -= cell.offY;
+	}
+}
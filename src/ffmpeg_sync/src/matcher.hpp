@@ -0,0 +1,263 @@
+#pragma once
+
+#include "fingerprint.hpp"
+#include "thumb_arena.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+// Mean absolute difference of the luma planes, in [0, 1]. Once the result is
+// known to exceed limit the comparison stops, and some value above it is returned.
+double compareFrames(const ThumbRef& ref, const ThumbRef& src, double limit = 1);
+
+// DP storage limited to a window of columns per row. Each row gets its
+// window when it is started, so memory and work grow with the windows
+// instead of ref * src. Every row is kept until the trace back, memory is
+// src records * band.
+template<typename T>
+class BandedMatrix {
+	struct Row {
+		size_t lo;
+		size_t width;
+
+		std::vector<T> cells;
+	};
+
+	std::vector<Row> rows;
+
+public:
+	size_t height() const {
+		return rows.size();
+	}
+
+	// Only up to reserve cells are allocated ahead, wide rows grow as they fill
+	void addRow(size_t lo, size_t width, size_t reserve) {
+		rows.push_back({ lo, width });
+		rows.back().cells.reserve(std::min(width, reserve));
+	}
+
+	// Drops rows from y on
+	void truncate(size_t y) {
+		rows.resize(y);
+	}
+
+	// Moves the end of row y's window, cells already filled stay
+	void widen(size_t y, size_t width) {
+		rows[y].width = width;
+	}
+
+	// Columns [lo, end) of row y are filled, the window ends at limit
+	size_t lo(size_t y) const {
+		return rows[y].lo;
+	}
+	size_t end(size_t y) const {
+		return rows[y].lo + rows[y].cells.size();
+	}
+	size_t limit(size_t y) const {
+		return rows[y].lo + rows[y].width;
+	}
+
+	T& extend(size_t y) {
+		rows[y].cells.emplace_back();
+		return rows[y].cells.back();
+	}
+
+	const T* find(size_t x, size_t y) const {
+		if (y >= rows.size() || x < lo(y) || x >= end(y)) {
+			return nullptr;
+		}
+
+		return &rows[y].cells[x - rows[y].lo];
+	}
+
+	T& at(size_t x, size_t y) {
+		return rows[y].cells[x - rows[y].lo];
+	}
+	const T& at(size_t x, size_t y) const {
+		return rows[y].cells[x - rows[y].lo];
+	}
+};
+
+// Frames closer than this are rewarded as a match
+const double matchTreshold = 0.05;
+// Frames further than this score negative, their exact distance is irrelevant
+const double rejectTreshold = matchTreshold + 0.01;
+
+// Fingerprints differing in more bits than this are not compared pixel by pixel
+extern int fingerprintTreshold;
+
+// Thumbnails without pixels, of another size or from an index built without
+// them, have their difference estimated from the fingerprint distance and the
+// coarse grid instead
+const double fingerprintDiffPerBit = 0.002;
+
+// Consecutive frames closer than this are one frozen run to the matcher, 0 turns it off
+extern double freezeTreshold;
+
+// Appends thumb as a record of its own, or extends the last record if the
+// picture didn't change. Still frames, title cards and black stretches then
+// take a single DP row or column however long they are.
+void appendCoalesced(ThumbArena& values, const Thumb& thumb);
+
+enum class MKind : uint8_t {
+	None, Match, Extra, Missing
+};
+
+// Runs are counted in records, a single match can span the whole file
+using Offset = uint32_t;
+using Score = int32_t;
+using PTS = int64_t;
+
+struct Cell {
+	MKind kind;
+
+	Offset offX;
+	Offset offY;
+
+	Score score;
+};
+
+struct Section {
+	PTS start;
+	PTS end;
+
+	PTS len() const {
+		return end - start;
+	}
+};
+
+struct pts_t {
+	PTS value;
+};
+
+inline pts_t pts(PTS value) {
+	return { value };
+}
+
+std::ostream& operator<<(std::ostream& out, const pts_t& obj);
+std::ostream& operator<<(std::ostream& out, const Section& obj);
+
+struct Match {
+	MKind kind;
+
+	Section ref;
+	Section src;
+
+	void print(std::ostream& out);
+
+	PTS delta() {
+		return ref.start - src.start;
+	}
+};
+
+class Matcher {
+
+public:
+	ThumbArena refValues;
+	ThumbArena srcValues;
+
+private:
+	BandedMatrix<Cell> matrix;
+	size_t band;
+
+	size_t maxW = 0;
+	size_t maxH = 0;
+
+	// Rows below this one have their whole window filled
+	size_t firstOpen = 0;
+
+	// Rows below this one were placed from a row that had its frames.
+	// Rows past it are placed from whatever the row above has so far and
+	// placed again if that changes their window.
+	size_t settledRows = 1;
+
+	// Last row that raised the best score, and how many times the rows
+	// after it were widened since. Rows placed from a stalled path double
+	// their width, back to gainRow, until the score rises again or another
+	// doubling would break the memory cap.
+	size_t gainRow = 0;
+	Score gainScore = 0;
+	int widenings = 0;
+
+	// Cells allocated but not filled yet, in row major order. Their frame
+	// comparisons run in parallel before the dependency walk.
+	struct Pending {
+		size_t x;
+		size_t y;
+
+		bool compare;
+		Score score;
+	};
+
+	std::vector<Pending> pending;
+	ThreadPool* pool;
+
+	const Cell* reached(size_t x, size_t y) const;
+
+	void offer(size_t x, size_t y, MKind kind, Score score = 0);
+
+	// Reads the thumbnails only, safe to call from several threads
+	Score matchScore(size_t x, size_t y) const;
+
+	void calc(const Pending& cell);
+	void queue(size_t x, size_t y);
+
+	// Scores the queued cells, on the pool if there are enough of them,
+	// then fills them in order
+	void flush();
+
+	// Column of the best reached cell of row y, the leftmost one on ties
+	size_t bestColumn(size_t y) const;
+
+	// New rows are centered one step diagonally from the best cell above,
+	// the band only ever moves right as the path is monotonic
+	size_t bandStart(size_t y) const;
+
+	size_t rowWidth() const;
+
+	// Another doubling of the rows since gainRow stays within the memory cap
+	bool canWiden() const;
+
+	// Row y has frames up to its window end, or a band past its best cell
+	bool ready(size_t y) const;
+
+	// Before row y is settled. False if the rows since gainRow were dropped
+	// and gainRow widened, they are placed again from there.
+	bool checkStall(size_t y);
+
+	// Places rows for every src frame and fills them up to the last ref frame
+	void fill();
+
+	// Cell the trace starts from, the corner if it is in the band
+	void frontier(size_t& x, size_t& y) const;
+
+	Match cellToMatch(size_t x, size_t y) const;
+
+public:
+	// band is the number of frames the path may drift off the diagonal of
+	// the previous row's best cell, more while the path is lost
+	Matcher(size_t band = 150, ThreadPool* pool = nullptr) : band(band), pool(pool) {
+	}
+
+	void calc();
+
+	using Visitor = std::function<void(Match)>;
+
+private:
+	// Frozen runs of different length may pair up. The match is split after
+	// each such pair and whatever one side has on top becomes an edit right
+	// there, where exactly within the frozen picture it went can't be told.
+	// Pieces are visited back to front like the rest of the trace.
+	void visitMatch(const Match& entry, size_t x, size_t y, const Visitor& visitor) const;
+
+public:
+	// Walks the best path back from the frontier. Frames past the band of
+	// the last rows are not reported.
+	void trace(Visitor visitor) const;
+};
@@ -0,0 +1,422 @@
+#include "coarse_align.hpp"
+#include "frame_index.hpp"
+#include "matcher.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	Matcher check on synthetic frames.
+
+	Every frame is a random grid of flat blocks, so any two differ clearly
+	and a frame only matches its own copy. Src is made from ref by cutting or
+	inserting frames, the two are fed to a Matcher in small chunks the way
+	the resync loop does, and the edits traced back have to be exactly the
+	ones made. Exits with 1 if any case failed.
+
+	ffmpeg_sync_tests
+*/
+
+namespace {
+	const int kWidth = 32;
+	const int kHeight = 18;
+	const int kBlock = 4;
+
+	const PTS kFrame = 40;
+
+	Thumb makeFrame(uint32_t seed, PTS pts) {
+		std::mt19937 random(seed);
+
+		Thumb thumb;
+		thumb.width = kWidth;
+		thumb.height = kHeight;
+		thumb.pixels.resize(kWidth * kHeight);
+
+		std::vector<uint8_t> blocks((kWidth / kBlock) * (kHeight / kBlock + 1));
+
+		for (auto& block : blocks) {
+			block = (uint8_t)random();
+		}
+
+		for (int y = 0; y < kHeight; y++) {
+			for (int x = 0; x < kWidth; x++) {
+				thumb.pixels[y * kWidth + x] = blocks[(y / kBlock) * (kWidth / kBlock) + x / kBlock];
+			}
+		}
+
+		thumb.print = Fingerprint::of(thumb.pixels.data(), kWidth, kWidth, kHeight);
+		thumb.pts = pts;
+		thumb.next = pts + kFrame;
+
+		return thumb;
+	}
+
+	// Frame seeds of a clip, src timestamps start at srcStart
+	struct Clip {
+		std::vector<uint32_t> ref;
+		std::vector<uint32_t> src;
+
+		PTS srcStart = 0;
+	};
+
+	using Append = std::function<void(ThumbArena&, const Thumb&)>;
+
+	// Ref frames come from refSource instead of the clip when given
+	std::vector<Match> run(const Clip& clip, size_t band, const Append& append = appendCoalesced, ThreadPool* pool = nullptr, ThumbSource* refSource = nullptr) {
+		const size_t chunk = 8;
+
+		Matcher matcher(band, pool);
+
+		size_t refPos = 0;
+		size_t srcPos = 0;
+
+		Thumb thumb;
+
+		while (refPos < clip.ref.size() || srcPos < clip.src.size()) {
+			for (size_t end = std::min(refPos + chunk, clip.ref.size()); refPos < end; refPos++) {
+				if (!refSource) {
+					append(matcher.refValues, makeFrame(clip.ref[refPos], refPos * kFrame));
+				} else if (refSource->read(thumb) != ffmpeg::FrameResult::END) {
+					append(matcher.refValues, thumb);
+				}
+			}
+			for (size_t end = std::min(srcPos + chunk, clip.src.size()); srcPos < end; srcPos++) {
+				append(matcher.srcValues, makeFrame(clip.src[srcPos], clip.srcStart + srcPos * kFrame));
+			}
+
+			matcher.calc();
+		}
+
+		std::vector<Match> edits;
+
+		matcher.trace([&](Match entry) {
+			if (entry.kind != MKind::Match) {
+				edits.insert(edits.begin(), entry);
+			}
+		});
+
+		return edits;
+	}
+
+	std::vector<uint32_t> seeds(uint32_t first, size_t count) {
+		std::vector<uint32_t> result;
+
+		for (size_t i = 0; i < count; i++) {
+			result.push_back(first + (uint32_t)i);
+		}
+
+		return result;
+	}
+
+	bool expect(const std::string& name, const std::vector<Match>& edits, const Match& wanted) {
+		bool ok = edits.size() == 1
+			&& edits[0].kind == wanted.kind
+			&& edits[0].ref.start == wanted.ref.start && edits[0].ref.end == wanted.ref.end
+			&& edits[0].src.start == wanted.src.start && edits[0].src.end == wanted.src.end;
+
+		printf("%-24s %s\n", name.c_str(), ok ? "ok" : "FAILED");
+
+		if (!ok) {
+			for (auto edit : edits) {
+				printf("    ");
+				edit.print(std::cout);
+			}
+		}
+
+		return ok;
+	}
+
+	// Ref has count frames src lacks, right after the first 300
+	Clip deleted(size_t count, PTS srcStart = 0) {
+		Clip clip;
+		clip.ref = seeds(1, 1400);
+		clip.src = clip.ref;
+		clip.src.erase(clip.src.begin() + 300, clip.src.begin() + 300 + count);
+		clip.srcStart = srcStart;
+
+		return clip;
+	}
+
+	bool deletion(size_t count, PTS srcStart = 0) {
+		Clip clip = deleted(count, srcStart);
+
+		const PTS at = 300 * kFrame;
+
+		std::string name = "deletion " + std::to_string(count);
+
+		if (srcStart) {
+			name += " at +" + std::to_string(srcStart);
+		}
+
+		return expect(name, run(clip, 150),
+			{ MKind::Missing, { at, at + PTS(count) * kFrame }, { srcStart + at, srcStart + at } });
+	}
+
+	bool insertion(size_t count, size_t band = 150) {
+		Clip clip;
+		clip.ref = seeds(1, 1400);
+		clip.src = clip.ref;
+
+		auto extra = seeds(100000, count);
+		clip.src.insert(clip.src.begin() + 300, extra.begin(), extra.end());
+
+		const PTS at = 300 * kFrame;
+
+		std::string name = "insertion " + std::to_string(count);
+
+		if (band != 150) {
+			name += " band " + std::to_string(band);
+		}
+
+		return expect(name, run(clip, band),
+			{ MKind::Extra, { at, at }, { at, at + PTS(count) * kFrame } });
+	}
+
+	// A still picture held for refFrames in ref and srcFrames in src, right
+	// after the first 300 frames. Whatever one side has on top is cut from
+	// the end of the run.
+	bool frozen(size_t refFrames, size_t srcFrames) {
+		Clip clip;
+		clip.ref = seeds(1, 1400);
+		clip.src = clip.ref;
+		clip.ref.insert(clip.ref.begin() + 300, refFrames, 99999);
+		clip.src.insert(clip.src.begin() + 300, srcFrames, 99999);
+
+		const PTS refEnd = PTS(300 + refFrames) * kFrame;
+		const PTS srcEnd = PTS(300 + srcFrames) * kFrame;
+
+		std::string name = "frozen " + std::to_string(refFrames) + " vs " + std::to_string(srcFrames);
+
+		if (refFrames > srcFrames) {
+			const PTS cut = PTS(300 + srcFrames) * kFrame;
+
+			return expect(name, run(clip, 150), { MKind::Missing, { cut, refEnd }, { srcEnd, srcEnd } });
+		}
+
+		const PTS cut = PTS(300 + refFrames) * kFrame;
+
+		return expect(name, run(clip, 150), { MKind::Extra, { refEnd, refEnd }, { cut, srcEnd } });
+	}
+
+	// Copies of a frame extend the record before them, a new picture starts one
+	bool coalesce() {
+		ThumbArena values;
+
+		for (size_t i = 0; i < 5; i++) {
+			appendCoalesced(values, makeFrame(7, PTS(i) * kFrame));
+		}
+
+		appendCoalesced(values, makeFrame(8, 5 * kFrame));
+
+		bool ok = values.size() == 2
+			&& values[0].frames == 5 && values[0].start() == 0 && values[0].end() == 5 * kFrame
+			&& values[1].frames == 1 && values[1].start() == 5 * kFrame;
+
+		printf("%-24s %s\n", "coalesce 5", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+
+	bool sameEdits(const std::vector<Match>& a, const std::vector<Match>& b) {
+		if (a.size() != b.size()) {
+			return false;
+		}
+
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].kind != b[i].kind
+				|| a[i].ref.start != b[i].ref.start || a[i].ref.end != b[i].ref.end
+				|| a[i].src.start != b[i].src.start || a[i].src.end != b[i].src.end) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Cells scored on the pool end up in the same path as serial ones. The
+	// widened rows of a long deletion are batches big enough to be split.
+	bool parallel() {
+		Clip clip = deleted(400);
+		ThreadPool pool(4);
+
+		bool ok = sameEdits(run(clip, 150), run(clip, 150, appendCoalesced, &pool));
+
+		printf("%-24s %s\n", "pool of 4", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+
+	// Ref frames of a clip, the way a decoder would deliver them
+	class ClipSource : public ThumbSource {
+		const std::vector<uint32_t>& seeds;
+		size_t pos = 0;
+
+	public:
+		ClipSource(const std::vector<uint32_t>& seeds) : seeds(seeds) {
+		}
+
+		ffmpeg::FrameResult read(Thumb& into) override {
+			if (pos == seeds.size()) {
+				return ffmpeg::FrameResult::END;
+			}
+
+			into = makeFrame(seeds[pos], pos * kFrame);
+			pos++;
+
+			return ffmpeg::FrameResult::OK;
+		}
+
+		void seek(int64_t pts) override {
+			pos = (size_t)std::min<int64_t>((pts + kFrame - 1) / kFrame, seeds.size());
+		}
+	};
+
+	// Batch jobs read ref back from an index, with its pixels they have to
+	// come to the same edits as a single run decoding it
+	bool indexed() {
+		Clip clip = deleted(80);
+
+		const auto path = (std::filesystem::temp_directory_path() / "ffmpeg_sync_check.fsidx").string();
+
+		IndexKey key;
+		key.size = clip.ref.size();
+
+		ClipSource decoded{ clip.ref };
+
+		bool ok = writeIndex(path, key, decoded);
+
+		if (ok) {
+			IndexedSource index;
+			ok = index.open(path, key);
+
+			Thumb first;
+			const Thumb wanted = makeFrame(clip.ref[0], 0);
+
+			ok = ok && index.read(first) == ffmpeg::FrameResult::OK && first.pixels == wanted.pixels;
+
+			index.seek(0);
+
+			ok = ok && sameEdits(run(clip, 150), run(clip, 150, appendCoalesced, nullptr, &index));
+		}
+
+		// The mapping is gone by now, Windows would not delete a mapped file
+		std::error_code error;
+		std::filesystem::remove(path, error);
+
+		printf("%-24s %s\n", "indexed ref", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+
+	// Src starts 300 frames into ref and lost every 5th frame, pairs by pts
+	// still line up. A ref shorter than the src window can't tell.
+	bool offsetEstimate() {
+		std::vector<Thumb> ref;
+		std::vector<Thumb> src;
+
+		for (uint32_t i = 0; i < 1000; i++) {
+			ref.push_back(makeFrame(i + 1, PTS(i) * kFrame));
+		}
+
+		for (uint32_t i = 0; i < 250; i++) {
+			if (i % 5 != 4) {
+				src.push_back(makeFrame(300 + i + 1, 5000 + PTS(i) * kFrame));
+			}
+		}
+
+		PTS offset;
+		double agreement;
+
+		bool ok = estimateOffset(ref, src, fingerprintTreshold, offset, agreement)
+			&& offset == 300 * kFrame - 5000 && agreement == 1;
+
+		ref.resize(200);
+
+		ok = ok && !estimateOffset(ref, src, fingerprintTreshold, offset, agreement);
+
+		printf("%-24s %s\n", "offset estimate", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+
+	// Thumbnails of a different size after clear() keep their pixels
+	bool arenaReuse() {
+		Thumb small = makeFrame(1, 0);
+
+		Thumb large;
+		large.width = kWidth * 2;
+		large.height = kHeight * 2;
+		large.pixels.assign(large.width * large.height, 200);
+		large.print = Fingerprint::of(large.pixels.data(), large.width, large.width, large.height);
+		large.pts = 0;
+		large.next = kFrame;
+
+		ThumbArena arena;
+		arena.push_back(small);
+		arena.clear();
+		arena.push_back(large);
+
+		auto stored = arena[0];
+
+		bool ok = stored.pixels && stored.width == large.width && stored.height == large.height
+			&& std::equal(large.pixels.begin(), large.pixels.end(), stored.pixels);
+
+		printf("%-24s %s\n", "arena reuse", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+
+	// A single match longer than a 16 bit run, frames pushed one by one
+	bool longRun() {
+		Clip clip;
+		clip.ref.assign(70000, 7);
+		clip.src = clip.ref;
+
+		auto edits = run(clip, 4, [](ThumbArena& values, const Thumb& thumb) {
+			values.push_back(thumb);
+		});
+
+		bool ok = edits.empty();
+
+		printf("%-24s %s\n", "run of 70000", ok ? "ok" : "FAILED");
+
+		return ok;
+	}
+}
+
+int main() {
+	bool ok = true;
+
+	for (size_t count : { 20, 80, 120, 200, 400 }) {
+		ok &= deletion(count);
+	}
+
+	// Src on a timeline of its own, each side of the edit keeps its own times
+	ok &= deletion(80, 5000);
+
+	ok &= insertion(300);
+
+	// Stalls long enough for the widening to reach its memory cap, the path
+	// has to come back in a narrow band
+	ok &= insertion(600, 4);
+	// Frozen runs take one record each side, the difference is still an edit
+	ok &= coalesce();
+	ok &= frozen(50, 30);
+	ok &= frozen(30, 50);
+	ok &= frozen(400, 1);
+
+	ok &= longRun();
+	ok &= parallel();
+	ok &= indexed();
+	ok &= offsetEstimate();
+	ok &= arenaReuse();
+
+	return ok ? 0 : 1;
+}
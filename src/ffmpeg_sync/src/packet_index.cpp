@@ -0,0 +1,222 @@
+#include "packet_index.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+using namespace ffmpeg;
+
+namespace {
+	bool byPts(const PacketEntry& entry, int64_t pts) {
+		return entry.pts < pts;
+	}
+
+	// Not cryptographic, only has to tell packets of one video apart
+	uint64_t hashBytes(const uint8_t* data, size_t size) {
+		const uint64_t prime = 0x9E3779B97F4A7C15ULL;
+
+		uint64_t hash = size * prime;
+		size_t i = 0;
+
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, 8);
+
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 29;
+		}
+
+		for (; i < size; i++) {
+			hash = (hash ^ data[i]) * prime;
+		}
+
+		return hash ^ (hash >> 32);
+	}
+
+	// Where a frame stops showing, the last one is as long as the one before
+	int64_t endOf(const std::vector<PacketEntry>& packets, size_t i) {
+		if (i + 1 < packets.size()) {
+			return packets[i + 1].pts;
+		}
+
+		return i > 0 ? 2 * packets[i].pts - packets[i - 1].pts : packets[i].pts;
+	}
+}
+
+void PacketIndex::build(const std::string& path, bool hashPayload) {
+	MValue<AVFormatContext> format;
+
+	guard(avformat_open_input(format.cdata(), path.data(), nullptr, nullptr));
+	guard(avformat_find_stream_info(format, nullptr));
+
+	int stream = av_find_best_stream(format, AVMediaType::AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	guard(stream);
+
+	// Only the chosen stream is demuxed
+	for (unsigned int idx = 0; idx < format->nb_streams; idx++) {
+		format->streams[idx]->discard = AVDISCARD_ALL;
+	}
+
+	format->streams[stream]->discard = AVDISCARD_DEFAULT;
+
+	MValue<AVPacket> packet = av_packet_alloc();
+
+	packets.clear();
+
+	while (true) {
+		int read = av_read_frame(format, packet);
+
+		if (read == AVERROR_EOF) {
+			break;
+		} else {
+			guard(read);
+		}
+
+		if (packet->stream_index == stream) {
+			int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+			if (pts != AV_NOPTS_VALUE) {
+				uint64_t hash = hashPayload ? hashBytes(packet->data, packet->size) : 0;
+
+				packets.push_back({ pts, packet->pos, hash, (packet->flags & AV_PKT_FLAG_KEY) != 0 });
+			}
+		}
+
+		av_packet_unref(packet);
+	}
+
+	// Packets come in decode order, B-frames are presented out of it
+	std::stable_sort(packets.begin(), packets.end(), [](const PacketEntry& a, const PacketEntry& b) {
+		return a.pts < b.pts;
+	});
+}
+
+const PacketEntry* PacketIndex::keyframeBefore(int64_t pts) const {
+	auto it = std::upper_bound(packets.begin(), packets.end(), pts, [](int64_t pts, const PacketEntry& entry) {
+		return pts < entry.pts;
+	});
+
+	while (it != packets.begin()) {
+		--it;
+
+		if (it->key) {
+			return &*it;
+		}
+	}
+
+	return nullptr;
+}
+
+const PacketEntry* PacketIndex::keyframeNear(int64_t pts, int64_t from, int64_t to) const {
+	const PacketEntry* best = nullptr;
+
+	auto it = std::lower_bound(packets.begin(), packets.end(), from, byPts);
+
+	for (; it != packets.end() && it->pts <= to; ++it) {
+		if (it->key && (!best || std::abs(it->pts - pts) < std::abs(best->pts - pts))) {
+			best = &*it;
+		}
+	}
+
+	return best;
+}
+
+size_t PacketIndex::countBetween(int64_t from, int64_t to) const {
+	auto begin = std::lower_bound(packets.begin(), packets.end(), from, byPts);
+	auto end = std::lower_bound(begin, packets.end(), to, byPts);
+
+	return end - begin;
+}
+
+std::vector<PacketRun> ffmpeg::identicalRuns(const PacketIndex& ref, const PacketIndex& src, size_t minPackets) {
+	auto& refPackets = ref.entries();
+	auto& srcPackets = src.entries();
+
+	// Static scenes repeat packets, only the first few places are tried
+	const size_t maxCandidates = 8;
+
+	std::unordered_map<uint64_t, std::vector<size_t>> places;
+
+	for (size_t i = 0; i < refPackets.size(); i++) {
+		places[refPackets[i].hash].push_back(i);
+	}
+
+	std::vector<PacketRun> runs;
+
+	size_t x = 0;
+	size_t y = 0;
+
+	while (y < srcPackets.size()) {
+		auto found = places.find(srcPackets[y].hash);
+
+		size_t bestX = 0;
+		size_t bestLen = 0;
+
+		if (found != places.end()) {
+			auto& candidates = found->second;
+			auto it = std::lower_bound(candidates.begin(), candidates.end(), x);
+
+			for (size_t tried = 0; it != candidates.end() && tried < maxCandidates; ++it, tried++) {
+				size_t len = 0;
+
+				while (*it + len < refPackets.size() && y + len < srcPackets.size()
+					&& refPackets[*it + len].hash == srcPackets[y + len].hash) {
+					len++;
+				}
+
+				if (len > bestLen) {
+					bestX = *it;
+					bestLen = len;
+				}
+			}
+		}
+
+		// Decoding only agrees from the first keyframe both sides share on
+		size_t skip = 0;
+
+		while (skip < bestLen && !(refPackets[bestX + skip].key && srcPackets[y + skip].key)) {
+			skip++;
+		}
+
+		if (bestLen < minPackets + skip) {
+			y++;
+			continue;
+		}
+
+		// Frames of the last GOP may refer to ones past the run, which differ.
+		// The run stops at the last keyframe both share, unless it goes on
+		// to the end of both files.
+		size_t end = bestLen;
+
+		if (bestX + bestLen < refPackets.size() || y + bestLen < srcPackets.size()) {
+			end = skip;
+
+			for (size_t i = bestLen - 1; i > skip; i--) {
+				if (refPackets[bestX + i].key && srcPackets[y + i].key) {
+					end = i;
+					break;
+				}
+			}
+		}
+
+		if (end < minPackets + skip) {
+			y++;
+			continue;
+		}
+
+		const size_t first = skip;
+
+		const bool whole = end == bestLen;
+
+		runs.push_back({
+			refPackets[bestX + first].pts, whole ? endOf(refPackets, bestX + end - 1) : refPackets[bestX + end].pts,
+			srcPackets[y + first].pts, whole ? endOf(srcPackets, y + end - 1) : srcPackets[y + end].pts,
+		});
+
+		x = bestX + bestLen;
+		y += bestLen;
+	}
+
+	return runs;
+}
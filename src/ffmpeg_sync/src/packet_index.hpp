@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ffmpeg_wrappers.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ffmpeg {
+
+	struct PacketEntry {
+		int64_t pts;
+		int64_t pos;    // Byte offset in the file, -1 if the demuxer doesn't know
+
+		uint64_t hash;  // Of size and payload, 0 unless asked for
+
+		bool key;
+	};
+
+	// Every packet of the video stream in presentation order, gathered by
+	// demuxing only. Costs a read of the file, no decoding, and tells a
+	// seek where the keyframes are and how far it has to decode past them.
+	class PacketIndex {
+		std::vector<PacketEntry> packets;
+
+	public:
+		void build(const std::string& path, bool hashPayload = false);
+
+		bool empty() const {
+			return packets.empty();
+		}
+
+		const std::vector<PacketEntry>& entries() const {
+			return packets;
+		}
+
+		// Last keyframe at or before pts, nullptr if there is none
+		const PacketEntry* keyframeBefore(int64_t pts) const;
+
+		// Keyframe in [from, to] closest to pts, nullptr if there is none
+		const PacketEntry* keyframeNear(int64_t pts, int64_t from, int64_t to) const;
+
+		// Packets presented in [from, to)
+		size_t countBetween(int64_t from, int64_t to) const;
+	};
+
+	// Stretch of byte identical packets. Starting from a keyframe the two
+	// files decode to the same frames there, no need to look at them. It
+	// ends at a keyframe too, the GOP after it may differ.
+	struct PacketRun {
+		int64_t refStart;
+		int64_t refEnd;
+
+		int64_t srcStart;
+		int64_t srcEnd;
+	};
+
+	// Runs of at least minPackets equal hashes, in order on both sides.
+	// Both indexes need their payloads hashed.
+	std::vector<PacketRun> identicalRuns(const PacketIndex& ref, const PacketIndex& src, size_t minPackets);
+
+}
@@ -0,0 +1,674 @@
+#include "remux.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+using namespace ffmpeg;
+
+namespace {
+	const AVRational kMillis{ 1, 1000 };
+
+	const int64_t kNone = std::numeric_limits<int64_t>::min();
+
+	void openInput(MValue<AVFormatContext>& format, const std::string& path) {
+		guard(avformat_open_input(format.cdata(), path.data(), nullptr, nullptr));
+		guard(avformat_find_stream_info(format, nullptr));
+	}
+
+	AVStream* addStream(AVFormatContext* out, const AVStream* from) {
+		AVStream* stream = guard(avformat_new_stream(out, nullptr));
+
+		guard(avcodec_parameters_copy(stream->codecpar, from->codecpar));
+
+		// Tags of one container mean nothing in another
+		stream->codecpar->codec_tag = 0;
+		stream->time_base = from->time_base;
+
+		return stream;
+	}
+
+	// Span of [start, end) wholly, nullptr if it crosses an edge or falls between spans
+	const KeptSpan* spanOf(const std::vector<KeptSpan>& spans, int64_t start, int64_t end) {
+		auto it = std::upper_bound(spans.begin(), spans.end(), start, [](int64_t time, const KeptSpan& span) {
+			return time < span.srcStart;
+		});
+
+		if (it == spans.begin() || std::prev(it)->srcEnd < end) {
+			return nullptr;
+		}
+
+		return &*std::prev(it);
+	}
+
+	using Emit = std::function<void(AVPacket* packet, AVRational timeBase)>;
+
+	// One src audio stream. Packets within a span are copied, the ones cut
+	// by a span edge are decoded and the samples kept are encoded again,
+	// together with silence for the ref time no src audio covers. Every
+	// output packet carries its own samples, none is sent twice.
+	class AudioCut {
+		// A piece of src kept from a packet across an edge, in samples
+		struct Piece {
+			int64_t srcFrom;
+			int64_t srcTo;
+
+			int64_t outFrom;
+		};
+
+		// Stretch of the patch, silence if src is kNone
+		struct Segment {
+			int64_t src;
+			int64_t length;
+		};
+
+		const AVStream* from;
+		const std::vector<KeptSpan>& spans;
+
+		AVRational samples;
+		int64_t tolerance;
+
+		MValue<AVCodecContext> decoder;
+		const AVCodec* encoderType = nullptr;
+
+		int frameSize = 0;
+		int padding = 0;
+
+		// Decoded samples from storeStart on, kept back to the lead the
+		// encoder needs before a patch
+		MValue<AVAudioFifo> store;
+		int64_t storeStart = 0;
+
+		MValue<AVFrame> frame = av_frame_alloc();
+		MValue<AVPacket> encoded = av_packet_alloc();
+
+		// End of the last samples sent out, on the output and on src
+		int64_t outAt = kNone;
+		int64_t srcAt = kNone;
+
+		// Error of the rounded patches so far, the next one makes up for it
+		int64_t carry = 0;
+
+		bool open = false;
+		std::vector<Piece> pieces;
+
+		int64_t toSamples(int64_t time, AVRational base) const {
+			return av_rescale_q(time, base, samples);
+		}
+
+		int64_t toSamples(int64_t ms) const {
+			if (ms == std::numeric_limits<int64_t>::max()) {
+				return ms;
+			}
+
+			return av_rescale_q(ms, kMillis, samples);
+		}
+
+		bool openEncoder(MValue<AVCodecContext>& encoder) const {
+			encoder = avcodec_alloc_context3(encoderType);
+
+			encoder->sample_fmt = decoder->sample_fmt;
+			encoder->sample_rate = decoder->sample_rate;
+			encoder->time_base = samples;
+			encoder->bit_rate = from->codecpar->bit_rate;
+			encoder->profile = from->codecpar->profile;
+
+			guard(av_channel_layout_copy(&encoder->ch_layout, &decoder->ch_layout));
+
+			return avcodec_open2(encoder, encoderType, nullptr) >= 0;
+		}
+
+		int channels() const {
+			return decoder->ch_layout.nb_channels;
+		}
+
+		void decode(const AVPacket* packet) {
+			// A broken packet costs a patch some silence, not the whole remux
+			int sent = avcodec_send_packet(decoder, packet);
+
+			if (sent < 0 && sent != AVERROR_INVALIDDATA && sent != AVERROR_EOF) {
+				guard(sent);
+			}
+
+			while (avcodec_receive_frame(decoder, frame) == 0) {
+				const int64_t at = frame->pts != AV_NOPTS_VALUE ? toSamples(frame->pts, from->time_base) : storeStart + av_audio_fifo_size(store);
+
+				if (frame->format != decoder->sample_fmt || frame->ch_layout.nb_channels != channels()) {
+					av_frame_unref(frame);
+					continue;
+				}
+
+				// Src jumped, what was kept before belongs elsewhere
+				if (std::abs(at - (storeStart + av_audio_fifo_size(store))) > tolerance) {
+					av_audio_fifo_reset(store);
+					storeStart = at;
+				}
+
+				guard(av_audio_fifo_write(store, (void**)frame->extended_data, frame->nb_samples));
+				av_frame_unref(frame);
+			}
+		}
+
+		// Samples of the lead before a patch, so its first packet starts on the patch
+		int64_t leadLength() const {
+			return int64_t(padding / frameSize + 1) * frameSize - padding;
+		}
+
+		void trim() {
+			if (open || srcAt == kNone) {
+				return;
+			}
+
+			const int64_t keep = srcAt - leadLength() - frameSize;
+
+			if (keep > storeStart) {
+				const int drop = (int)std::min<int64_t>(keep - storeStart, av_audio_fifo_size(store));
+
+				av_audio_fifo_drain(store, drop);
+				storeStart += drop;
+			}
+		}
+
+		// Writes count samples of src from srcFrom into frame at offset, silence where none were kept
+		void fill(AVFrame* into, int offset, int64_t srcFrom, int count) {
+			const auto format = AVSampleFormat(into->format);
+
+			const bool planar = av_sample_fmt_is_planar(format);
+			const int stride = av_get_bytes_per_sample(format) * (planar ? 1 : channels());
+			const int planes = planar ? channels() : 1;
+
+			const int64_t storeEnd = storeStart + av_audio_fifo_size(store);
+
+			const int64_t first = std::clamp(srcFrom, storeStart, storeEnd);
+			const int64_t last = std::clamp(srcFrom + count, storeStart, storeEnd);
+
+			guard(av_samples_set_silence(into->extended_data, offset, count, channels(), format));
+
+			if (first < last) {
+				std::vector<void*> data(planes);
+
+				for (int p = 0; p < planes; p++) {
+					data[p] = into->extended_data[p] + (offset + (first - srcFrom)) * stride;
+				}
+
+				av_audio_fifo_peek_at(store, data.data(), int(last - first), int(first - storeStart));
+			}
+		}
+
+		// Sends the patch out and picks up copying at outEnd
+		void close(int64_t outEnd, const Emit& emit) {
+			open = false;
+
+			const int64_t outStart = outAt != kNone ? outAt : pieces.empty() ? outEnd : pieces.front().outFrom;
+			const int64_t leadSrc = srcAt;
+
+			// Src went on where the output already is, nothing to fill
+			if (outEnd <= outStart) {
+				pieces.clear();
+				return;
+			}
+
+			std::vector<Segment> segments;
+			int64_t cursor = outStart;
+
+			for (auto& piece : pieces) {
+				if (piece.outFrom > cursor) {
+					segments.push_back({ kNone, piece.outFrom - cursor });
+					cursor = piece.outFrom;
+				}
+
+				const int64_t skip = std::max<int64_t>(0, cursor - piece.outFrom);
+				const int64_t end = std::min(piece.outFrom + (piece.srcTo - piece.srcFrom), outEnd);
+
+				if (end > cursor) {
+					segments.push_back({ piece.srcFrom + skip, end - cursor });
+					cursor = end;
+				}
+			}
+
+			if (outEnd > cursor || segments.empty()) {
+				segments.push_back({ kNone, outEnd - cursor });
+			}
+
+			pieces.clear();
+
+			// Whole encoder frames only, a short one would end the stream. The
+			// difference goes into the longest silence, or else where the first
+			// piece ends, which is the edit itself.
+			const int64_t length = outEnd - outStart;
+			const int64_t frames = std::max<int64_t>(0, std::llround(double(length - carry) / frameSize));
+			int64_t change = frames * frameSize - length;
+
+			carry += change;
+
+			size_t at = 0;
+
+			for (size_t i = 0; i < segments.size(); i++) {
+				if (segments[i].src == kNone && (segments[at].src != kNone || segments[i].length > segments[at].length)) {
+					at = i;
+				}
+			}
+
+			if (!segments.empty() && segments[at].src != kNone && change > 0) {
+				segments.insert(segments.begin() + std::min<size_t>(1, segments.size()), { kNone, 0 });
+				at = std::min<size_t>(1, segments.size() - 1);
+			}
+
+			for (size_t i = at; change != 0 && i < segments.size(); i++) {
+				const int64_t step = std::max(change, -segments[i].length);
+
+				segments[i].length += step;
+				change -= step;
+			}
+
+			if (frames > 0) {
+				encode(outStart, frames, leadSrc, segments, emit);
+			}
+
+			outAt = outEnd;
+		}
+
+		void encode(int64_t outStart, int64_t frames, int64_t leadSrc, const std::vector<Segment>& segments, const Emit& emit) {
+			MValue<AVCodecContext> encoder;
+
+			if (!openEncoder(encoder)) {
+				return;
+			}
+
+			const int64_t lead = leadLength();
+			const int64_t outEnd = outStart + frames * frameSize;
+
+			// Input as a list of stretches, the lead first
+			std::vector<Segment> input;
+			input.push_back({ leadSrc != kNone ? leadSrc - lead : kNone, lead });
+			input.insert(input.end(), segments.begin(), segments.end());
+
+			MValue<AVFrame> block = av_frame_alloc();
+
+			block->format = encoder->sample_fmt;
+			block->sample_rate = encoder->sample_rate;
+			guard(av_channel_layout_copy(&block->ch_layout, &encoder->ch_layout));
+
+			int64_t pts = outStart - lead;
+
+			auto receive = [&] {
+				while (avcodec_receive_packet(encoder, encoded) == 0) {
+					if (encoded->pts >= outStart && encoded->pts < outEnd) {
+						encoded->dts = encoded->pts;
+						encoded->duration = frameSize;
+
+						emit(encoded, samples);
+					}
+
+					av_packet_unref(encoded);
+				}
+			};
+
+			size_t segment = 0;
+			int64_t used = 0;
+
+			while (segment < input.size()) {
+				block->nb_samples = frameSize;
+				guard(av_frame_get_buffer(block, 0));
+
+				int filled = 0;
+
+				for (; segment < input.size() && filled < frameSize; ) {
+					auto& part = input[segment];
+					const int count = (int)std::min<int64_t>(frameSize - filled, part.length - used);
+
+					if (part.src == kNone) {
+						guard(av_samples_set_silence(block->extended_data, filled, count, channels(), encoder->sample_fmt));
+					} else {
+						fill(block, filled, part.src + used, count);
+					}
+
+					filled += count;
+					used += count;
+
+					if (used == part.length) {
+						segment++;
+						used = 0;
+					}
+				}
+
+				if (filled == 0) {
+					av_frame_unref(block);
+					break;
+				}
+
+				block->nb_samples = filled;
+				block->pts = pts;
+				pts += filled;
+
+				guard(avcodec_send_frame(encoder, block));
+				av_frame_unref(block);
+
+				receive();
+			}
+
+			guard(avcodec_send_frame(encoder, nullptr));
+			receive();
+		}
+
+	public:
+		const int target;
+
+		AudioCut(const AVStream* from, int target, const std::vector<KeptSpan>& spans) : from(from), spans(spans), target(target) {
+			const AVCodec* decoderType = avcodec_find_decoder(from->codecpar->codec_id);
+
+			samples = { 1, std::max(1, from->codecpar->sample_rate) };
+			tolerance = samples.den / 1000 + 1;
+
+			if (!decoderType) {
+				return;
+			}
+
+			decoder = avcodec_alloc_context3(decoderType);
+
+			guard(avcodec_parameters_to_context(decoder, from->codecpar));
+			decoder->pkt_timebase = from->time_base;
+
+			if (avcodec_open2(decoder, decoderType, nullptr) < 0 || decoder->sample_rate != samples.den) {
+				return;
+			}
+
+			encoderType = avcodec_find_encoder(from->codecpar->codec_id);
+
+			// Tried once to learn the frame size and the delay, HE-AAC and
+			// the like don't have an encoder of the same profile
+			MValue<AVCodecContext> probe;
+
+			if (!encoderType || !openEncoder(probe) || probe->frame_size <= 0) {
+				encoderType = nullptr;
+				return;
+			}
+
+			frameSize = probe->frame_size;
+			padding = probe->initial_padding;
+
+			store = av_audio_fifo_alloc(decoder->sample_fmt, channels(), frameSize * 8);
+		}
+
+		// Without an encoder packets are copied whole into the span they start in
+		bool cuts() const {
+			return encoderType != nullptr;
+		}
+
+		void add(AVPacket* packet, const Emit& emit) {
+			const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+			const int64_t start = toSamples(pts, from->time_base);
+			const int64_t end = start + std::max<int64_t>(1, toSamples(packet->duration, from->time_base));
+
+			decode(packet);
+
+			auto copy = [&](const KeptSpan& span) {
+				const int64_t shift = av_rescale_q(span.delta, kMillis, from->time_base);
+
+				if (packet->pts != AV_NOPTS_VALUE) {
+					packet->pts += shift;
+				}
+				if (packet->dts != AV_NOPTS_VALUE) {
+					packet->dts += shift;
+				}
+
+				outAt = end + toSamples(span.delta);
+				srcAt = end;
+
+				emit(packet, from->time_base);
+			};
+
+			// Spans are in ms, a packet is within one if it is to the ms
+			const int64_t startMs = av_rescale_q(start, samples, kMillis);
+			const int64_t endMs = av_rescale_q(end - 1, samples, kMillis) + 1;
+
+			if (auto span = spanOf(spans, startMs, endMs)) {
+				const int64_t outStart = start + toSamples(span->delta);
+
+				if (open || (outAt != kNone && std::abs(outStart - outAt) > tolerance)) {
+					// A gap before it, or the end of a patch
+					open = true;
+					close(outStart, emit);
+				}
+
+				copy(*span);
+				trim();
+
+				return;
+			}
+
+			open = true;
+
+			for (auto& span : spans) {
+				const int64_t first = std::max(start, toSamples(span.srcStart));
+				const int64_t last = std::min(end, toSamples(span.srcEnd));
+
+				if (first < last) {
+					pieces.push_back({ first, last, first + toSamples(span.delta) });
+				}
+			}
+
+			if (outAt == kNone && pieces.empty()) {
+				// Nothing sent yet, dropped packets before the first span have nothing to patch
+				open = false;
+			}
+		}
+
+		void finish(const Emit& emit) {
+			decode(nullptr);
+
+			if (open) {
+				close(pieces.empty() ? outAt : pieces.back().outFrom + (pieces.back().srcTo - pieces.back().srcFrom), emit);
+			}
+		}
+	};
+}
+
+bool ffmpeg::remux(const std::string& refPath, const std::string& srcPath, const std::vector<KeptSpan>& spans, const std::string& outPath) {
+	// Each span has to start after the one before on both timelines, or the
+	// packets moved by them would go back in time
+	for (size_t i = 1; i < spans.size(); i++) {
+		auto& a = spans[i - 1];
+		auto& b = spans[i];
+
+		if (b.srcStart < a.srcEnd || b.srcStart + b.delta < a.srcEnd + a.delta) {
+			std::cerr << "Kept spans out of order: src " << a.srcStart << "-" << a.srcEnd << " moved by " << a.delta;
+			std::cerr << ", then src " << b.srcStart << "-" << b.srcEnd << " moved by " << b.delta << std::endl;
+			return false;
+		}
+	}
+
+	MValue<AVFormatContext> ref;
+	MValue<AVFormatContext> src;
+
+	openInput(ref, refPath);
+	openInput(src, srcPath);
+
+	MValue<AVFormatContext> out;
+	guard(avformat_alloc_output_context2(out.cdata(), nullptr, nullptr, outPath.data()));
+
+	int refVideo = av_find_best_stream(ref, AVMediaType::AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	guard(refVideo);
+
+	// Only the chosen stream is demuxed
+	for (unsigned int idx = 0; idx < ref->nb_streams; idx++) {
+		ref->streams[idx]->discard = AVDISCARD_ALL;
+	}
+
+	ref->streams[refVideo]->discard = AVDISCARD_DEFAULT;
+
+	addStream(out, ref->streams[refVideo]);
+
+	// Output stream of each src stream, -1 for the ones left out
+	std::vector<int> srcMap(src->nb_streams, -1);
+	std::vector<std::unique_ptr<AudioCut>> audio(src->nb_streams);
+
+	for (unsigned int idx = 0; idx < src->nb_streams; idx++) {
+		auto type = src->streams[idx]->codecpar->codec_type;
+
+		if (type == AVMediaType::AVMEDIA_TYPE_AUDIO || type == AVMediaType::AVMEDIA_TYPE_SUBTITLE) {
+			srcMap[idx] = addStream(out, src->streams[idx])->index;
+		} else {
+			src->streams[idx]->discard = AVDISCARD_ALL;
+		}
+
+		if (type == AVMediaType::AVMEDIA_TYPE_AUDIO) {
+			audio[idx] = std::make_unique<AudioCut>(src->streams[idx], srcMap[idx], spans);
+		}
+	}
+
+	if (!(out->oformat->flags & AVFMT_NOFILE)) {
+		guard(avio_open(&out->pb, outPath.data(), AVIO_FLAG_WRITE));
+	}
+
+	guard(avformat_write_header(out, nullptr));
+
+	// Last dts per output stream. A packet going back means the spans moved
+	// content out of order, the output would play it wrong.
+	std::vector<int64_t> lastDts(out->nb_streams, kNone);
+	bool ordered = true;
+
+	const bool equalDts = out->oformat->flags & AVFMT_TS_NONSTRICT;
+
+	auto write = [&](AVPacket* packet, AVRational timeBase, int target) {
+		AVStream* stream = out->streams[target];
+
+		packet->stream_index = target;
+		av_packet_rescale_ts(packet, timeBase, stream->time_base);
+
+		if (packet->dts != AV_NOPTS_VALUE && lastDts[target] != kNone) {
+			if (packet->dts < lastDts[target] || (packet->dts == lastDts[target] && !equalDts)) {
+				std::cerr << "Output stream " << target << " goes back from dts " << lastDts[target] << " to " << packet->dts << std::endl;
+
+				ordered = false;
+				av_packet_unref(packet);
+				return;
+			}
+		}
+
+		if (packet->dts != AV_NOPTS_VALUE) {
+			lastDts[target] = packet->dts;
+		}
+
+		// Takes the packet's reference
+		guard(av_interleaved_write_frame(out, packet));
+	};
+
+	MValue<AVPacket> packet = av_packet_alloc();
+
+	// Output time reached on each side, the one behind reads next so the
+	// muxer never has to hold much
+	int64_t refAt = kNone;
+	int64_t srcAt = kNone;
+
+	bool refDone = false;
+	bool srcDone = false;
+
+	while (ordered && (!refDone || !srcDone)) {
+		const bool fromRef = !refDone && (srcDone || refAt <= srcAt);
+
+		int read = av_read_frame(fromRef ? ref : src, packet);
+
+		if (read == AVERROR_EOF) {
+			(fromRef ? refDone : srcDone) = true;
+			continue;
+		} else {
+			guard(read);
+		}
+
+		if (fromRef) {
+			if (packet->stream_index != refVideo) {
+				av_packet_unref(packet);
+				continue;
+			}
+
+			const AVStream* from = ref->streams[refVideo];
+
+			if (packet->dts != AV_NOPTS_VALUE) {
+				refAt = av_rescale_q(packet->dts, from->time_base, kMillis);
+			}
+
+			write(packet, from->time_base, 0);
+			continue;
+		}
+
+		const int target = srcMap[packet->stream_index];
+		const AVStream* from = src->streams[packet->stream_index];
+
+		int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+		if (target < 0 || pts == AV_NOPTS_VALUE) {
+			av_packet_unref(packet);
+			continue;
+		}
+
+		const int64_t start = av_rescale_q(pts, from->time_base, kMillis);
+
+		// Span the packet starts in, the src side moves along by its offset
+		// even for dropped packets
+		auto last = std::upper_bound(spans.begin(), spans.end(), start, [](int64_t time, const KeptSpan& span) {
+			return time < span.srcStart;
+		});
+
+		const KeptSpan* span = last != spans.begin() ? &*std::prev(last) : nullptr;
+
+		srcAt = std::max(srcAt, start + (span ? span->delta : 0));
+
+		if (span && start >= span->srcEnd) {
+			span = nullptr;
+		}
+
+		auto& cut = audio[packet->stream_index];
+
+		if (cut && cut->cuts()) {
+			cut->add(packet, [&](AVPacket* output, AVRational timeBase) {
+				write(output, timeBase, target);
+			});
+
+			av_packet_unref(packet);
+			continue;
+		}
+
+		// Subtitles, and audio without an encoder, go whole into the span
+		// they start in
+		if (span) {
+			const int64_t shift = av_rescale_q(span->delta, kMillis, from->time_base);
+
+			if (packet->pts != AV_NOPTS_VALUE) {
+				packet->pts += shift;
+			}
+			if (packet->dts != AV_NOPTS_VALUE) {
+				packet->dts += shift;
+			}
+
+			if (!cut && packet->duration > 0) {
+				packet->duration = std::min(packet->duration, av_rescale_q(span->srcEnd - start, kMillis, from->time_base));
+			}
+
+			write(packet, from->time_base, target);
+		}
+
+		av_packet_unref(packet);
+	}
+
+	for (auto& cut : audio) {
+		if (ordered && cut && cut->cuts()) {
+			cut->finish([&](AVPacket* output, AVRational timeBase) {
+				write(output, timeBase, cut->target);
+			});
+		}
+	}
+
+	guard(av_write_trailer(out));
+
+	if (!(out->oformat->flags & AVFMT_NOFILE)) {
+		avio_closep(&out->pb);
+	}
+
+	return ordered;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ffmpeg_wrappers.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ffmpeg {
+
+	// Stretch of src that shows up in ref, moved by delta. Times in ms.
+	struct KeptSpan {
+		int64_t srcStart;
+		int64_t srcEnd;
+
+		int64_t delta;
+	};
+
+	// Writes the video of ref and the audio and subtitles of src to outPath.
+	// Src packets are placed on the ref timeline by the span they fall in,
+	// and dropped outside of all spans. Audio packets cut by a span edge are
+	// decoded, trimmed and encoded again, ref time between spans is filled
+	// with silence. Every other packet is copied once as it is. Spans must
+	// be sorted and move forward on both timelines. False, with the reason
+	// on stderr, if they don't or the output would go back in time.
+	bool remux(const std::string& refPath, const std::string& srcPath, const std::vector<KeptSpan>& spans, const std::string& outPath);
+
+}
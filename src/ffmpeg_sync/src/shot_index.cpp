@@ -0,0 +1,131 @@
+#include "shot_index.hpp"
+#include "frame_compare.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace ffmpeg;
+
+namespace {
+	bool isCut(const Thumb& previous, const Thumb& current, const ShotOptions& options) {
+		// Index entries carry no pixels, only the fingerprint is left to go by
+		if (previous.pixels.empty() || current.pixels.empty()
+			|| previous.width != current.width || previous.height != current.height) {
+			return distance(previous.print, current.print) > options.cutBits;
+		}
+
+		const uint64_t pixels = uint64_t(current.width) * current.height;
+		const uint64_t limit = uint64_t(options.cutDiff * 255 * pixels);
+
+		return sumAbsDiff(previous.pixels.data(), previous.width, current.pixels.data(), current.width,
+			current.width, current.height, limit) > limit;
+	}
+
+	// 0 if the shots can't be the same, otherwise higher for better evidence
+	int pairScore(const Shot& ref, const Shot& src, const ShotOptions& options) {
+		const bool head = distance(ref.first, src.first) <= options.matchBits;
+		const bool tail = distance(ref.last, src.last) <= options.matchBits;
+
+		if (!head && !tail) {
+			return 0;
+		}
+
+		// Flat frames are close to everything, the length tells black shots apart
+		const int64_t frame = std::max<int64_t>(1, std::max(ref.len() / ref.frames, src.len() / src.frames));
+		const bool sameLength = std::abs(ref.len() - src.len()) < frame;
+
+		return int(head) + int(tail) + int(sameLength);
+	}
+}
+
+std::vector<Shot> detectShots(ThumbSource& source, const ShotOptions& options) {
+	std::vector<Shot> shots;
+
+	Thumb previous;
+	Thumb current;
+
+	while (source.read(current) != FrameResult::END) {
+		if (shots.empty() || isCut(previous, current, options)) {
+			Shot shot;
+			shot.start = current.start();
+			shot.first = current.print;
+			shots.push_back(shot);
+		}
+
+		Shot& shot = shots.back();
+		shot.end = current.end();
+		shot.last = current.print;
+		shot.frames++;
+
+		std::swap(previous, current);
+	}
+
+	return shots;
+}
+
+std::vector<ShotPair> alignShots(const std::vector<Shot>& ref, const std::vector<Shot>& src, const ShotOptions& options) {
+	enum Move : uint8_t {
+		Pair,
+		SkipRef,
+		SkipSrc,
+	};
+
+	// Plain global alignment, a few thousand shots per side fit in memory
+	const size_t w = ref.size() + 1;
+	const size_t h = src.size() + 1;
+
+	std::vector<int> score(w * h, 0);
+	std::vector<uint8_t> moves(w * h, Pair);
+
+	for (size_t x = 1; x < w; x++) {
+		moves[x] = SkipRef;
+	}
+
+	for (size_t y = 1; y < h; y++) {
+		moves[y * w] = SkipSrc;
+
+		for (size_t x = 1; x < w; x++) {
+			const size_t i = y * w + x;
+
+			score[i] = score[i - 1];
+			moves[i] = SkipRef;
+
+			if (score[i - w] > score[i]) {
+				score[i] = score[i - w];
+				moves[i] = SkipSrc;
+			}
+
+			const int pair = pairScore(ref[x - 1], src[y - 1], options);
+
+			if (pair && score[i - w - 1] + pair > score[i]) {
+				score[i] = score[i - w - 1] + pair;
+				moves[i] = Pair;
+			}
+		}
+	}
+
+	std::vector<ShotPair> pairs;
+
+	for (size_t x = w - 1, y = h - 1; x || y;) {
+		switch (moves[y * w + x]) {
+		case Pair:
+			pairs.push_back({ int(x) - 1, int(y) - 1 });
+			x--;
+			y--;
+			break;
+
+		case SkipRef:
+			pairs.push_back({ int(x) - 1, -1 });
+			x--;
+			break;
+
+		case SkipSrc:
+			pairs.push_back({ -1, int(y) - 1 });
+			y--;
+			break;
+		}
+	}
+
+	std::reverse(pairs.begin(), pairs.end());
+	return pairs;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "thumb_source.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+	Shot level alignment.
+
+	Cuts are found by streaming over a video once and comparing consecutive
+	thumbnails. Each shot keeps the fingerprints of its first and last frame,
+	so a shot trimmed at either end still pairs up. The shot lists of ref and
+	src are then aligned like the frame matcher aligns frames, only with
+	thousands of shots instead of hundreds of thousands of frames.
+*/
+
+struct Shot {
+	int64_t start = 0;
+	int64_t end = 0;
+
+	int frames = 0;
+
+	Fingerprint first;
+	Fingerprint last;
+
+	int64_t len() const {
+		return end - start;
+	}
+};
+
+struct ShotOptions {
+	double cutDiff = 0.12;    // Mean luma difference of a cut, for thumbnails with pixels
+	int cutBits = 64;         // Fingerprint distance of a cut, for thumbnails without
+	int matchBits = 48;       // Fingerprint distance of shots that pair up
+};
+
+// Reads source to the end, splitting it at cuts
+std::vector<Shot> detectShots(ThumbSource& source, const ShotOptions& options);
+
+// Pair of shots with the same content, either index may be -1 for a shot
+// only one side has. Listed in playback order.
+struct ShotPair {
+	int ref;
+	int src;
+};
+
+std::vector<ShotPair> alignShots(const std::vector<Shot>& ref, const std::vector<Shot>& src, const ShotOptions& options);
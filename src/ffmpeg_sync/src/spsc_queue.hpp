@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Bounded single producer, single consumer ring. Slots are reused, push and pop
+// swap values in and out, so objects owning buffers (MFrame) keep their
+// allocation cycling between the two threads. A side that finds the ring full
+// or empty sleeps until the other side moves, the lock is only taken then.
+template<typename T>
+class SpscQueue {
+	static constexpr size_t kCacheLine = 64;
+
+	std::vector<T> slots;
+	size_t mask;
+
+	// Each index is only written by one side, keep them on separate lines
+	alignas(kCacheLine) std::atomic<size_t> head{ 0 };
+	alignas(kCacheLine) std::atomic<size_t> tail{ 0 };
+
+	// Sides asleep in push or pop
+	alignas(kCacheLine) std::atomic<int> sleepers{ 0 };
+	std::mutex mutex;
+	std::condition_variable moved;
+
+	// Pairs with the increment in sleep, either the sleeper sees the new
+	// index or this sees the sleeper
+	void notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (sleepers.load(std::memory_order_relaxed) != 0) {
+			std::lock_guard<std::mutex> lock{ mutex };
+			moved.notify_all();
+		}
+	}
+
+	template<typename Ready>
+	void sleep(Ready ready) {
+		std::unique_lock<std::mutex> lock{ mutex };
+
+		sleepers.fetch_add(1, std::memory_order_seq_cst);
+		moved.wait(lock, ready);
+		sleepers.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+public:
+	// Capacity is rounded up to a power of two
+	SpscQueue(size_t capacity = 64) {
+		size_t size = 1;
+
+		while (size < capacity) {
+			size <<= 1;
+		}
+
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	// Producer only
+	bool tryPush(T& value) {
+		auto pos = tail.load(std::memory_order_relaxed);
+
+		if (pos - head.load(std::memory_order_acquire) > mask) {
+			return false;
+		}
+
+		std::swap(slots[pos & mask], value);
+		tail.store(pos + 1, std::memory_order_release);
+
+		notify();
+
+		return true;
+	}
+
+	// Consumer only
+	bool tryPop(T& into) {
+		auto pos = head.load(std::memory_order_relaxed);
+
+		if (pos == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		std::swap(slots[pos & mask], into);
+		head.store(pos + 1, std::memory_order_release);
+
+		notify();
+
+		return true;
+	}
+
+	// Blocking variants. push gives up once cancel is set, see wake.
+	bool push(T& value, const std::atomic<bool>& cancel) {
+		while (!tryPush(value)) {
+			sleep([&] { return cancel || tail.load() - head.load() <= mask; });
+
+			if (cancel) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+	void pop(T& into) {
+		while (!tryPop(into)) {
+			sleep([&] { return head.load() != tail.load(); });
+		}
+	}
+
+	// Rouses a sleeping side to look at its cancel flag again
+	void wake() {
+		std::lock_guard<std::mutex> lock{ mutex };
+		moved.notify_all();
+	}
+
+	// Only while neither side is active
+	void clear() {
+		head.store(0);
+		tail.store(0);
+	}
+};
@@ -0,0 +1,99 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (unsigned i = 1; i < threads; i++) {
+		workers.emplace_back([this] { work(); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	wake.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+// Takes the next block and runs it unlocked, false once none are left
+bool ThreadPool::runBlock(std::unique_lock<std::mutex>& lock) {
+	if (!body || next >= count) {
+		return false;
+	}
+
+	const size_t begin = next;
+	const size_t end = std::min(count, begin + grain);
+
+	next = end;
+	active++;
+
+	const Body& fn = *body;
+
+	lock.unlock();
+	fn(begin, end);
+	lock.lock();
+
+	if (--active == 0 && next >= count) {
+		done.notify_all();
+	}
+
+	return true;
+}
+
+void ThreadPool::work() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	uint64_t seen = 0;
+
+	while (true) {
+		wake.wait(lock, [&] { return stopping || generation != seen; });
+
+		if (stopping) {
+			return;
+		}
+
+		seen = generation;
+
+		while (runBlock(lock)) {
+		}
+	}
+}
+
+void ThreadPool::run(size_t count, size_t grain, const Body& fn) {
+	if (count == 0) {
+		return;
+	}
+
+	// Not worth waking anyone up
+	if (workers.empty() || count <= grain) {
+		fn(0, count);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	this->body = &fn;
+	this->count = count;
+	this->grain = std::max<size_t>(grain, (count + size() * 4 - 1) / (size() * 4));
+	this->next = 0;
+
+	generation++;
+	wake.notify_all();
+
+	while (runBlock(lock)) {
+	}
+
+	done.wait(lock, [&] { return active == 0 && next >= this->count; });
+
+	this->body = nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers for data parallel loops. The calling thread joins in,
+// run() returns once every block is done.
+class ThreadPool {
+public:
+	using Body = std::function<void(size_t begin, size_t end)>;
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const Body* body = nullptr;
+
+	size_t count = 0;
+	size_t grain = 1;
+	size_t next = 0;
+	size_t active = 0;
+
+	uint64_t generation = 0;
+	bool stopping = false;
+
+	void work();
+	bool runBlock(std::unique_lock<std::mutex>& lock);
+
+public:
+	// 0 uses every hardware thread, 1 runs everything on the caller
+	explicit ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	void operator=(const ThreadPool&) = delete;
+
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	// Calls fn on [begin, end) blocks of at least grain items covering [0, count)
+	void run(size_t count, size_t grain, const Body& fn);
+};
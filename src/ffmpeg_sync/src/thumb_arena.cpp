@@ -0,0 +1,55 @@
+#include "thumb_arena.hpp"
+
+#include <cstring>
+
+void ThumbArena::push_back(const Thumb& thumb) {
+	const size_t i = size();
+
+	bool pixels = !thumb.pixels.empty();
+
+	if (pixels && recordSize == 0) {
+		width = thumb.width;
+		height = thumb.height;
+
+		// A 96x54 thumbnail is exactly 81 cache lines
+		recordSize = (size_t(width) * height + kAlign - 1) / kAlign * kAlign;
+	}
+
+	pixels = pixels && thumb.width == width && thumb.height == height;
+
+	if (pixels) {
+		// Chunks are indexed by record number, earlier ones may stay unallocated
+		if (chunks.size() <= i / kChunkRecords) {
+			chunks.resize(i / kChunkRecords + 1);
+		}
+
+		auto& chunk = chunks[i / kChunkRecords];
+
+		if (!chunk) {
+			chunk.reset(new (std::align_val_t(kAlign)) uint8_t[kChunkRecords * recordSize]);
+		}
+
+		std::memcpy(record(i), thumb.pixels.data(), thumb.pixels.size());
+	}
+
+	prints.push_back(thumb.print);
+	starts.push_back(thumb.pts);
+	ends.push_back(thumb.next);
+	hasPixels.push_back(pixels);
+	frames.push_back(1);
+}
+
+void ThumbArena::clear() {
+	// The next thumbnail with pixels sets the layout again
+	width = 0;
+	height = 0;
+	recordSize = 0;
+
+	chunks.clear();
+
+	prints.clear();
+	starts.clear();
+	ends.clear();
+	hasPixels.clear();
+	frames.clear();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "fingerprint.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Read only view of a thumbnail, wherever it is stored
+struct ThumbRef {
+	const uint8_t* pixels;    // nullptr if only the fingerprint is known
+	const Fingerprint& print;
+
+	int width;
+	int height;
+
+	int64_t pts;
+	int64_t next;
+
+	uint32_t frames;          // Near identical frames the record stands for
+
+	ThumbRef(const uint8_t* pixels, const Fingerprint& print, int width, int height, int64_t pts, int64_t next, uint32_t frames = 1)
+		: pixels(pixels), print(print), width(width), height(height), pts(pts), next(next), frames(frames) {
+	}
+	ThumbRef(const Thumb& thumb)
+		: ThumbRef(thumb.pixels.empty() ? nullptr : thumb.pixels.data(), thumb.print, thumb.width, thumb.height, thumb.pts, thumb.next) {
+	}
+
+	int64_t start() const {
+		return pts;
+	}
+	int64_t end() const {
+		return next;
+	}
+};
+
+// Append only store for the thumbnails a Matcher holds. Pixels are fixed
+// size records, each starting on a cache line, in chunks that never move;
+// fingerprints and timestamps sit in parallel arrays. Everything goes back
+// to the heap at once when the arena is cleared or destroyed.
+class ThumbArena {
+	static constexpr size_t kAlign = 64;
+	static constexpr size_t kChunkRecords = 256;
+
+	struct AlignedDelete {
+		void operator()(uint8_t* chunk) const {
+			::operator delete[](chunk, std::align_val_t(kAlign));
+		}
+	};
+
+	using Chunk = std::unique_ptr<uint8_t[], AlignedDelete>;
+
+	// Taken from the first thumbnail with pixels
+	int width = 0;
+	int height = 0;
+	size_t recordSize = 0;
+
+	std::vector<Chunk> chunks;
+
+	std::vector<Fingerprint> prints;
+	std::vector<int64_t> starts;
+	std::vector<int64_t> ends;
+	std::vector<uint8_t> hasPixels;
+	std::vector<uint32_t> frames;
+
+	uint8_t* record(size_t i) const {
+		return chunks[i / kChunkRecords].get() + (i % kChunkRecords) * recordSize;
+	}
+
+public:
+	size_t size() const {
+		return starts.size();
+	}
+	bool empty() const {
+		return starts.empty();
+	}
+
+	// Thumbnails of another size than the first one keep only their fingerprint
+	void push_back(const Thumb& thumb);
+
+	// Lets the last record stand for one more frame, up to next
+	void extendBack(int64_t next) {
+		ends.back() = next;
+		frames.back()++;
+	}
+
+	// Valid until the next push_back
+	ThumbRef operator[](size_t i) const {
+		return { hasPixels[i] ? record(i) : nullptr, prints[i], width, height, starts[i], ends[i], frames[i] };
+	}
+
+	void clear();
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "fingerprint.hpp"
+#include "frame_source.hpp"
+
+#include <string>
+
+// Sequence of thumbnails the matcher consumes, either decoded on the fly or
+// read back from an index
+class ThumbSource {
+public:
+	virtual ~ThumbSource() {}
+
+	// Same contract as Video::readWithNext
+	virtual ffmpeg::FrameResult read(Thumb& into) = 0;
+
+	// Continues from the first thumbnail starting at or after pts
+	virtual void seek(int64_t pts) = 0;
+};
+
+class DecodedSource : public ThumbSource {
+	ffmpeg::FrameSource frames;
+	ffmpeg::MFrame buffer;
+
+public:
+	DecodedSource(ffmpeg::Video& video, const std::string& filterDesc, int core = -1)
+		: frames(video, filterDesc, core) {
+	}
+
+	ffmpeg::FrameResult read(Thumb& into) override {
+		if (frames.read(buffer) == ffmpeg::FrameResult::END) {
+			return ffmpeg::FrameResult::END;
+		}
+
+		into = Thumb(buffer);
+		return ffmpeg::FrameResult::OK;
+	}
+
+	void seek(int64_t pts) override {
+		frames.seek(pts);
+	}
+};
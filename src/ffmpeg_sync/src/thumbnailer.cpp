@@ -0,0 +1,192 @@
+#include "thumbnailer.hpp"
+
+extern "C" {
+	#include <libavutil/pixdesc.h>
+}
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define FS_X86 1
+
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	#define FS_NEON 1
+
+	#include <arm_neon.h>
+#endif
+
+using namespace ffmpeg;
+
+namespace {
+
+	// 16 bit column sums hold up to 257 rows of 255
+	const int kMaxBlockRows = 257;
+
+	// Vertical half of the box filter, sums[x] = column x summed over count
+	// rows. Reads every source byte once, row by row.
+	void sumRows(const uint8_t* plane, ptrdiff_t stride, int count, int width, uint16_t* sums) {
+		const int vecWidth = width & ~15;
+
+		for (int y = 0; y < count; y++) {
+			const uint8_t* line = plane + stride * y;
+			int x = 0;
+
+#if defined(FS_X86)
+			const __m128i zero = _mm_setzero_si128();
+
+			for (; x < vecWidth; x += 16) {
+				__m128i pixels = _mm_loadu_si128((const __m128i*) (line + x));
+
+				__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+				__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+
+				if (y != 0) {
+					lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i*) (sums + x)));
+					hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i*) (sums + x + 8)));
+				}
+
+				_mm_storeu_si128((__m128i*) (sums + x), lo);
+				_mm_storeu_si128((__m128i*) (sums + x + 8), hi);
+			}
+#elif defined(FS_NEON)
+			for (; x < vecWidth; x += 16) {
+				uint8x16_t pixels = vld1q_u8(line + x);
+
+				uint16x8_t lo = vmovl_u8(vget_low_u8(pixels));
+				uint16x8_t hi = vmovl_u8(vget_high_u8(pixels));
+
+				if (y != 0) {
+					lo = vaddq_u16(lo, vld1q_u16(sums + x));
+					hi = vaddq_u16(hi, vld1q_u16(sums + x + 8));
+				}
+
+				vst1q_u16(sums + x, lo);
+				vst1q_u16(sums + x + 8, hi);
+			}
+#endif
+
+			for (; x < width; x++) {
+				sums[x] = uint16_t((y != 0 ? sums[x] : 0) + line[x]);
+			}
+		}
+	}
+
+	bool isFullRange(int format, AVColorRange range) {
+		switch (format) {
+			case AV_PIX_FMT_GRAY8:
+			case AV_PIX_FMT_YUVJ420P:
+			case AV_PIX_FMT_YUVJ422P:
+			case AV_PIX_FMT_YUVJ444P:
+				return true;
+		}
+
+		return range == AVCOL_RANGE_JPEG;
+	}
+
+	// 8 bit luma in plane 0 with nothing else packed in between
+	bool hasPlainLuma(int format) {
+		auto desc = av_pix_fmt_desc_get(AVPixelFormat(format));
+
+		if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL))) {
+			return false;
+		}
+
+		auto& luma = desc->comp[0];
+
+		return luma.plane == 0 && luma.step == 1 && luma.offset == 0 && luma.shift == 0 && luma.depth == 8;
+	}
+
+}
+
+Thumbnailer::Thumbnailer(int width, int height) : width(width), height(height) {
+	for (int value = 0; value < 256; value++) {
+		expand[value] = uint8_t(std::clamp((int) std::lround((value - 16) * 255 / 219.0), 0, 255));
+	}
+}
+
+bool Thumbnailer::parse(const std::string& filterDesc, int& width, int& height) {
+	char rest = 0;
+
+	return std::sscanf(filterDesc.data(), "format=gray,scale=%dx%d%c", &width, &height, &rest) == 2
+		&& width > 0 && height > 0;
+}
+
+void Thumbnailer::layout(int sourceWidth, int sourceHeight) {
+	this->sourceWidth = sourceWidth;
+	this->sourceHeight = sourceHeight;
+
+	columns.resize(width + 1);
+	rows.resize(height + 1);
+
+	for (int x = 0; x <= width; x++) {
+		columns[x] = int(int64_t(x) * sourceWidth / width);
+	}
+	for (int y = 0; y <= height; y++) {
+		rows[y] = int(int64_t(y) * sourceHeight / height);
+	}
+
+	sums.resize(sourceWidth);
+}
+
+bool Thumbnailer::scale(const MFrame& frame, MFrame& into) {
+	if (!enabled() || !hasPlainLuma(frame->format)) {
+		return false;
+	}
+
+	if (frame->width < width || frame->height < height || (frame->height + height - 1) / height > kMaxBlockRows) {
+		return false;
+	}
+
+	if (frame->width != sourceWidth || frame->height != sourceHeight) {
+		layout(frame->width, frame->height);
+	}
+
+	// Frames come back through the queue, after the first lap nothing is allocated
+	if (!into || into->format != AV_PIX_FMT_GRAY8 || into->width != width || into->height != height || !av_frame_is_writable(*into)) {
+		av_frame_unref(*into);
+
+		into->format = AV_PIX_FMT_GRAY8;
+		into->width = width;
+		into->height = height;
+
+		guard(av_frame_get_buffer(*into, 0));
+	}
+
+	const bool full = isFullRange(frame->format, frame->color_range);
+
+	const uint8_t* plane = frame->data[0];
+	const ptrdiff_t stride = frame->linesize[0];
+
+	for (int y = 0; y < height; y++) {
+		const int y0 = rows[y];
+		const int y1 = rows[y + 1];
+
+		sumRows(plane + stride * y0, stride, y1 - y0, sourceWidth, sums.data());
+
+		uint8_t* line = into->data[0] + ptrdiff_t(into->linesize[0]) * y;
+
+		for (int x = 0; x < width; x++) {
+			const int x0 = columns[x];
+			const int x1 = columns[x + 1];
+
+			uint32_t total = 0;
+
+			for (int i = x0; i < x1; i++) {
+				total += sums[i];
+			}
+
+			const uint32_t area = uint32_t(x1 - x0) * uint32_t(y1 - y0);
+			const uint8_t mean = uint8_t((total + area / 2) / area);
+
+			line[x] = full ? mean : expand[mean];
+		}
+	}
+
+	into->pts = frame->pts;
+	into.next = frame.next;
+
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ffmpeg_wrappers.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ffmpeg {
+
+	// Gray thumbnails straight from the luma plane of 8 bit YUV frames. Each
+	// output pixel is the mean of its block of source pixels, limited range
+	// luma is stretched to full range the way format=gray does. Frames it
+	// can't take (RGB, high bit depth, hardware, upscaling) are left to the
+	// filter graph.
+	class Thumbnailer {
+		int width = 0;
+		int height = 0;
+
+		// Source geometry the block edges were computed for
+		int sourceWidth = 0;
+		int sourceHeight = 0;
+
+		std::vector<int> columns;    // width + 1 block edges in the source
+		std::vector<int> rows;       // height + 1
+		std::vector<uint16_t> sums;  // Column sums of one block row
+
+		uint8_t expand[256];
+
+		void layout(int sourceWidth, int sourceHeight);
+
+	public:
+		// A 0 size turns the thumbnailer off
+		Thumbnailer(int width = 0, int height = 0);
+
+		// Size of a plain "format=gray,scale=WxH" graph, the only kind this can stand in for
+		static bool parse(const std::string& filterDesc, int& width, int& height);
+
+		bool enabled() const {
+			return width > 0 && height > 0;
+		}
+
+		// Writes the thumbnail of frame into into, reusing its buffer when it
+		// has the right size. False if the frame needs the filter graph.
+		bool scale(const MFrame& frame, MFrame& into);
+	};
+
+}
@@ -0,0 +1,131 @@
+#include "demo_scene.hpp"
+
+#define H 0.4
+#define L 0.1
+ 
+#define S 10
+ 
+namespace {
+	// Owns every material and object of the demo, members point at each other
+	// so it must stay in place once constructed
+	struct DemoObjects {
+		RoughMaterial colors[8] = {
+			RoughMaterial( Color(H,H,H), S ),
+			RoughMaterial( Color(H,H,L), S ),
+			RoughMaterial( Color(H,L,H), S ),
+			RoughMaterial( Color(H,L,L), S ),
+			RoughMaterial( Color(L,H,H), S ),
+			RoughMaterial( Color(L,H,L), S ),
+			RoughMaterial( Color(L,L,H), S ),
+			RoughMaterial( Color(L,L,L), S )
+		};
+ 
+		SmoothMaterial glass{ 1.5f,                   Color(0.1,0.1,0.1)   }; 
+		SmoothMaterial gold { Color(0.17, 0.35, 1.5), Color(3.1, 2.7, 1.9) };
+ 
+		ScenePlane plane0{ &colors[0],  Vector( 5, 0, 0 ), -Vector( 1, 0, 0 ), -Vector( 0, 0, 1 ) };
+		ScenePlane plane1{ &colors[1], -Vector( 5, 0, 0 ),  Vector( 1, 0, 0 ),  Vector( 0, 0, 1 ) };
+		ScenePlane plane2{ &colors[2],  Vector( 0, 5, 0 ), -Vector( 0, 1, 0 ), -Vector( 1, 0, 0 ) };
+		ScenePlane plane3{ &colors[3], -Vector( 0, 5, 0 ),  Vector( 0, 1, 0 ),  Vector( 1, 0, 0 ) };
+		ScenePlane plane4{ &colors[4],  Vector( 0, 0, 5 ), -Vector( 0, 0, 1 ), -Vector( 1, 0, 0 ) };
+		ScenePlane plane5{ &colors[5], -Vector( 0, 0, 8 ),  Vector( 0, 0, 1 ),  Vector( 1, 0, 0 ) };
+ 
+		SceneParaboloid parab0{ &gold, Vector( 6, 0, 0 ), Vector( -12, 0, 0 ) };
+
+		SceneEllipse             ellipseShape{ &glass, Vector() };
+		SceneMover<SceneEllipse> ellipse{ &ellipseShape, Vector(2,2,2), Vector(0.1,0.1,0.1) };
+
+		Light light0{ Vector(0,0,4), Vector(0,0.1,0), Color(1,1,1) };
+
+
+		SceneSphere sph00{ &glass, Vector(0,0,-1 + 0.0f), 3.0f };
+		SceneSphere sph01{ &glass, Vector(0,0,-1 + 0.4f), 3.2f };
+
+
+		SceneBoolean<SceneSphere, SceneSphere> bool0{ &sph00, &sph01 };
+
+		SceneObj* scene[9] = {
+			&plane1, 
+			&plane2, 
+			&plane3, 
+			&plane4, 
+			&plane5,
+ 
+			&parab0, 
+			&ellipse,
+
+			&bool0,
+
+			NULL
+		};
+	};
+
+	auto bindStaticScene( DemoObjects& objs ){
+		return StaticScene(
+			objs.light0, Color(0),
+
+			bindStatic<RoughMaterial, MAT_SHADOW_CASTER>(objs.plane1),
+			bindStatic<RoughMaterial, MAT_SHADOW_CASTER>(objs.plane2),
+			bindStatic<RoughMaterial, MAT_SHADOW_CASTER>(objs.plane3),
+			bindStatic<RoughMaterial, MAT_SHADOW_CASTER>(objs.plane4),
+			bindStatic<RoughMaterial, MAT_SHADOW_CASTER>(objs.plane5),
+
+			bindStatic<SmoothMaterial, MAT_SHADOW_CASTER | MAT_REFLECT>(objs.parab0),
+			bindStatic<SmoothMaterial, MAT_REFLECT | MAT_REFRACT>(objs.ellipse),
+
+			bindStatic<SmoothMaterial, MAT_REFLECT | MAT_REFRACT>(objs.bool0)
+		);
+	}
+
+	typedef decltype(bindStaticScene(std::declval<DemoObjects&>())) DemoStaticScene;
+
+	// Bases are constructed in order, the objects exist before the scene binds them
+	struct DynamicDemo : DemoObjects, TracedScene<SceneList> {
+		DynamicDemo() :
+			TracedScene<SceneList>(scene, light0)
+		{}
+	};
+
+	struct StaticDemo : DemoObjects, TracedScene<DemoStaticScene> {
+		StaticDemo() :
+			TracedScene<DemoStaticScene>(bindStaticScene(*this))
+		{}
+	};
+}
+ 
+std::unique_ptr<Scene> makeDemoScene( bool staticDispatch ){
+	if ( staticDispatch )
+		return std::unique_ptr<Scene>(new StaticDemo());
+ 
+	return std::unique_ptr<Scene>(new DynamicDemo());
+}
+ 
+Camera demoCamera(){
+	Camera cam;
+	 cam.pos = Vector(-4,4,2);
+	 cam.up  = Vector(0,0,1);
+	 cam.dir = Vector(1,-0.8,-0.2);
+ 
+	 cam.fov = 2.5f;
+ 
+	 cam.T = 10;
+	 cam.C = 1;
+ 
+	return cam;
+}
+ 
+bool applyDemoPreset( Camera& cam, char key ){
+	switch( key ){
+		case 'c':
+			cam.pos = Vector(-4,4,4); 
+			cam.dir = Vector(1,-0.8,-0.5);
+			return true;
+ 
+		case 'v':
+			cam.pos = Vector(-4,0,0);
+			cam.dir = Vector(1,0,0);
+			return true;
+	}
+ 
+	return false;
+}
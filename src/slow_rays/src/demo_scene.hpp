@@ -0,0 +1,15 @@
+#pragma once
+
+#include "renderer.hpp"
+
+#include <memory>
+
+// The demo room. staticDispatch selects the compile-time specialized scene,
+// otherwise objects are traced through the runtime SceneObj list.
+std::unique_ptr<Scene> makeDemoScene( bool staticDispatch = true );
+
+// Default view of the demo scene
+Camera demoCamera();
+
+// Applies one of the 'c'/'v' camera presets, returns false for unknown keys
+bool applyDemoPreset( Camera& cam, char key );
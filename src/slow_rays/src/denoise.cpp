@@ -0,0 +1,259 @@
+#include "denoise.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+	// Planar copy of a buffer, rows of a single channel are contiguous so the
+	// filter loops run over plain float arrays and vectorize
+	struct Planes {
+		int width;
+		int height;
+
+		std::vector<float> data;
+
+		Planes( int width, int height, int count ) :
+			width(width),
+			height(height),
+
+			data(width * height * count)
+		{}
+
+		float* plane( int index ){
+			return &data[index * width * height];
+		}
+		const float* plane( int index ) const {
+			return &data[index * width * height];
+		}
+	};
+
+	enum {
+		R, G, B,
+		COUNT_COLOR
+	};
+
+	enum {
+		NX, NY, NZ,
+		PX, PY, PZ,
+		AR, AG, AB,
+		MASK,
+		COUNT_GUIDE
+	};
+
+	const float albedoEpsilon = 0.01f;
+
+	// Cheap decaying kernel standing in for exp(-t), t >= 0. Branch free so the
+	// weight loop vectorizes, the exact falloff does not matter for edge stopping.
+	inline float falloff( float t ){
+		float t2 = t * t;
+
+		return 1.0f / (1.0f + t + t2 * 0.5f + t2 * t * (1.0f / 6) + t2 * t2 * (1.0f / 24));
+	}
+
+	struct Weights {
+		float invColor;
+		float invNormal;
+		float invPosition;
+		float invAlbedo;
+	};
+
+	// One a-trous pass over rows [y0, y1) with taps step pixels apart
+	void filterRows( const Planes& in, Planes& out, const Planes& guide, const Weights& weights, int step, int y0, int y1 ){
+		static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+
+		const int w = in.width;
+		const int h = in.height;
+
+		std::vector<float> acc(w * 4);
+
+		float* accR   = &acc[0];
+		float* accG   = &acc[w];
+		float* accB   = &acc[w * 2];
+		float* accSum = &acc[w * 3];
+
+		for ( int y = y0; y < y1; y++ ){
+			std::fill(acc.begin(), acc.end(), 0.0f);
+
+			const int row = y * w;
+
+			const float* pR = in.plane(R) + row;
+			const float* pG = in.plane(G) + row;
+			const float* pB = in.plane(B) + row;
+
+			const float* pNX = guide.plane(NX) + row;
+			const float* pNY = guide.plane(NY) + row;
+			const float* pNZ = guide.plane(NZ) + row;
+			const float* pPX = guide.plane(PX) + row;
+			const float* pPY = guide.plane(PY) + row;
+			const float* pPZ = guide.plane(PZ) + row;
+			const float* pAR = guide.plane(AR) + row;
+			const float* pAG = guide.plane(AG) + row;
+			const float* pAB = guide.plane(AB) + row;
+			const float* pM  = guide.plane(MASK) + row;
+
+			for ( int ky = 0; ky < 5; ky++ ){
+				int qy = y + (ky - 2) * step;
+
+				if ( qy < 0 || qy >= h )
+					continue;
+
+				for ( int kx = 0; kx < 5; kx++ ){
+					const int dx = (kx - 2) * step;
+					const int q  = qy * w + dx;
+
+					const float tap = kernel[ky] * kernel[kx];
+
+					// Only the x range whose taps land inside the image, no clamping in the loop
+					const int x0 = std::max(0, -dx);
+					const int x1 = std::min(w, w - dx);
+
+					const float* qR = in.plane(R) + q;
+					const float* qG = in.plane(G) + q;
+					const float* qB = in.plane(B) + q;
+
+					const float* qNX = guide.plane(NX) + q;
+					const float* qNY = guide.plane(NY) + q;
+					const float* qNZ = guide.plane(NZ) + q;
+					const float* qPX = guide.plane(PX) + q;
+					const float* qPY = guide.plane(PY) + q;
+					const float* qPZ = guide.plane(PZ) + q;
+					const float* qAR = guide.plane(AR) + q;
+					const float* qAG = guide.plane(AG) + q;
+					const float* qAB = guide.plane(AB) + q;
+					const float* qM  = guide.plane(MASK) + q;
+
+					for ( int x = x0; x < x1; x++ ){
+						float dR = qR[x] - pR[x];
+						float dG = qG[x] - pG[x];
+						float dB = qB[x] - pB[x];
+
+						float dNX = qNX[x] - pNX[x];
+						float dNY = qNY[x] - pNY[x];
+						float dNZ = qNZ[x] - pNZ[x];
+
+						float dPX = qPX[x] - pPX[x];
+						float dPY = qPY[x] - pPY[x];
+						float dPZ = qPZ[x] - pPZ[x];
+
+						float dAR = qAR[x] - pAR[x];
+						float dAG = qAG[x] - pAG[x];
+						float dAB = qAB[x] - pAB[x];
+
+						float dist =
+							(dR*dR + dG*dG + dB*dB)       * weights.invColor +
+							(dNX*dNX + dNY*dNY + dNZ*dNZ) * weights.invNormal +
+							(dPX*dPX + dPY*dPY + dPZ*dPZ) * weights.invPosition +
+							(dAR*dAR + dAG*dAG + dAB*dAB) * weights.invAlbedo;
+
+						// Background and geometry never blend
+						float same = 1.0f - fabsf(qM[x] - pM[x]);
+
+						float weight = tap * same * falloff(dist);
+
+						accR[x]   += weight * qR[x];
+						accG[x]   += weight * qG[x];
+						accB[x]   += weight * qB[x];
+						accSum[x] += weight;
+					}
+				}
+			}
+
+			float* oR = out.plane(R) + row;
+			float* oG = out.plane(G) + row;
+			float* oB = out.plane(B) + row;
+
+			// The center tap always contributes, the sum cannot be zero
+			for ( int x = 0; x < w; x++ ){
+				float inv = 1.0f / accSum[x];
+
+				oR[x] = accR[x] * inv;
+				oG[x] = accG[x] * inv;
+				oB[x] = accB[x] * inv;
+			}
+		}
+	}
+
+	// Splits the rows between threads and waits for all of them
+	template<typename Fn>
+	void parallelRows( int height, int threads, Fn fn ){
+		threads = std::max(1, std::min(threads, height));
+
+		std::vector<std::thread> pool;
+
+		for ( int i = 1; i < threads; i++ )
+			pool.emplace_back(fn, height * i / threads, height * (i + 1) / threads);
+
+		fn(0, height / threads);
+
+		for ( std::thread& thread : pool )
+			thread.join();
+	}
+}
+
+void denoise( Color* image, const GBuffer& aux, const DenoiseOptions& options ){
+	const int w = aux.width;
+	const int h = aux.height;
+
+	int threads = options.threads > 0 ? options.threads : (int) std::thread::hardware_concurrency();
+
+	Planes color(w, h, COUNT_COLOR);
+	Planes temp(w, h, COUNT_COLOR);
+	Planes guide(w, h, COUNT_GUIDE);
+
+	// Demodulate the albedo, the filter works on lighting only
+	parallelRows(h, threads, [&]( int y0, int y1 ){
+		for ( int i = y0 * w; i < y1 * w; i++ ){
+			const Color&  c = image[i];
+			const Color&  a = aux.albedo[i];
+			const Vector& n = aux.normal[i];
+			const Vector& p = aux.pos[i];
+
+			color.plane(R)[i] = c.r / std::max(a.r, albedoEpsilon);
+			color.plane(G)[i] = c.g / std::max(a.g, albedoEpsilon);
+			color.plane(B)[i] = c.b / std::max(a.b, albedoEpsilon);
+
+			guide.plane(NX)[i] = n.x;
+			guide.plane(NY)[i] = n.y;
+			guide.plane(NZ)[i] = n.z;
+			guide.plane(PX)[i] = p.x;
+			guide.plane(PY)[i] = p.y;
+			guide.plane(PZ)[i] = p.z;
+			guide.plane(AR)[i] = a.r;
+			guide.plane(AG)[i] = a.g;
+			guide.plane(AB)[i] = a.b;
+
+			guide.plane(MASK)[i] = aux.coverage[i];
+		}
+	});
+
+	Weights weights;
+	 weights.invColor    = 1.0f / (options.sigmaColor    * options.sigmaColor);
+	 weights.invNormal   = 1.0f / (options.sigmaNormal   * options.sigmaNormal);
+	 weights.invPosition = 1.0f / (options.sigmaPosition * options.sigmaPosition);
+	 weights.invAlbedo   = 1.0f / (options.sigmaAlbedo   * options.sigmaAlbedo);
+
+	Planes* src = &color;
+	Planes* dst = &temp;
+
+	for ( int i = 0; i < options.iterations; i++ ){
+		parallelRows(h, threads, [&]( int y0, int y1 ){
+			filterRows(*src, *dst, guide, weights, 1 << i, y0, y1);
+		});
+
+		std::swap(src, dst);
+
+		weights.invColor *= 2;
+	}
+
+	parallelRows(h, threads, [&]( int y0, int y1 ){
+		for ( int i = y0 * w; i < y1 * w; i++ ){
+			const Color& a = aux.albedo[i];
+
+			image[i] = Color(
+				src->plane(R)[i] * std::max(a.r, albedoEpsilon),
+				src->plane(G)[i] * std::max(a.g, albedoEpsilon),
+				src->plane(B)[i] * std::max(a.b, albedoEpsilon)
+			);
+		}
+	});
+}
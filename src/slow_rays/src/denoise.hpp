@@ -0,0 +1,47 @@
+#pragma once
+
+#include "raytracer.hpp"
+
+#include <vector>
+
+// Guide buffers for the denoiser, first hits of the camera rays averaged over
+// the samples of each pixel
+struct GBuffer {
+	int width;
+	int height;
+
+	std::vector<Vector> pos;
+	std::vector<Vector> normal;
+	std::vector<Color>  albedo;
+	std::vector<float>  coverage;   // Fraction of the samples that hit anything
+
+	GBuffer( int width = 0, int height = 0 ) :
+		width(width),
+		height(height),
+
+		pos(width * height),
+		normal(width * height),
+		albedo(width * height),
+		coverage(width * height)
+	{}
+};
+
+struct DenoiseOptions {
+	// Footprint doubles every iteration, 2 covers 13x13 pixels. The demo scene
+	// is only noisy along edges, wider filters blur the mirrors.
+	int iterations = 2;
+
+	// Edge stopping, smaller values preserve more edges. The color term is
+	// tightened every iteration as the image gets smoother.
+	float sigmaColor    = 0.2f;
+	float sigmaNormal   = 0.1f;
+	float sigmaPosition = 0.05f;
+	float sigmaAlbedo   = 0.1f;
+
+	int threads = 0;        // 0 uses every hardware thread
+};
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) over a row-major
+// image. Lighting is divided by the albedo before filtering and multiplied back
+// after, so surface texture is not blurred together with the noise.
+void denoise( Color* image, const GBuffer& aux, const DenoiseOptions& options );
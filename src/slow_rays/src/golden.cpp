@@ -0,0 +1,380 @@
+#include "demo_scene.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+	Golden image regression check for the demo scene.
+
+	Renders a fixed set of views headlessly, compares them against reference
+	images in a perceptual (CIELAB) space and appends the render times to a CSV
+	history. Exits with 1 if any view drifted past the tolerance, or became
+	slower than the recent history allows.
+
+	slow_rays_golden <golden dir> [--update] [--history <csv>] [--commit <id>]
+	                 [--width <w>] [--height <h>] [--repeat <n>] [--threads <n>]
+	                 [--max-delta-e <dE>] [--max-bad-pixels <fraction>] [--max-slowdown <fraction>]
+*/
+
+struct View {
+	const char* name;
+
+	char  preset;   // 'c'/'v' preset from the frontend, 0 for the default view
+	float T;
+	float C;
+};
+
+const View views[] = {
+	{ "default_t10_c1",     0,  10, 1      },
+	{ "default_t20_c1",     0,  20, 1      },
+	{ "default_t10_cinf",   0,  10, 100000 },
+
+	{ "c_t10_c1",         'c',  10, 1      },
+	{ "c_t20_c1",         'c',  20, 1      },
+	{ "c_t10_cinf",       'c',  10, 100000 },
+
+	{ "v_t10_c1",         'v',  10, 1      },
+	{ "v_t20_c1",         'v',  20, 1      },
+	{ "v_t10_cinf",       'v',  10, 100000 },
+};
+
+struct Options {
+	std::string golden;
+	std::string history = "slow_rays_timings.csv";
+	std::string commit  = "unknown";
+
+	bool update = false;
+
+	int width  = 320;
+	int height = 180;
+	int repeat = 3;
+
+	int threads = 1;    // Single threaded by default, timings stay comparable across hosts
+
+	float maxDeltaE     = 2.3f;     // Just noticeable difference
+	float maxBadPixels  = 0.002f;   // Fraction of pixels allowed above maxDeltaE
+	float maxSlowdown   = 0.2f;     // Allowed slowdown relative to the recent history
+};
+
+typedef std::vector<unsigned char> Pixels;
+
+// Same clamping glDrawPixels does for GL_FLOAT input
+unsigned char toByte( float v ){
+	v = v < 0 ? 0 : v > 1 ? 1 : v;
+
+	return (unsigned char) (v * 255 + 0.5f);
+}
+
+bool writePPM( const std::string& path, const Pixels& rgb, int w, int h ){
+	FILE* file = fopen(path.c_str(), "wb");
+
+	if ( !file )
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", w, h);
+	fwrite(rgb.data(), 1, rgb.size(), file);
+
+	return fclose(file) == 0;
+}
+
+bool readPPM( const std::string& path, Pixels& rgb, int& w, int& h ){
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if ( !file )
+		return false;
+
+	int max = 0;
+	bool ok = fscanf(file, "P6 %d %d %d", &w, &h, &max) == 3 && max == 255 && fgetc(file) != EOF;
+
+	if ( ok ){
+		rgb.resize(w * h * 3);
+		ok = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+	}
+
+	fclose(file);
+	return ok;
+}
+
+struct Lab {
+	float L, a, b;
+};
+
+float srgbToLinear( unsigned char c ){
+	float v = c / 255.0f;
+
+	return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+float labF( float t ){
+	return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+Lab toLab( const unsigned char* rgb ){
+	float r = srgbToLinear(rgb[0]);
+	float g = srgbToLinear(rgb[1]);
+	float b = srgbToLinear(rgb[2]);
+
+	// D65 white point
+	float X = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+	float Y = (0.2126f * r + 0.7152f * g + 0.0722f * b);
+	float Z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+
+	float fX = labF(X);
+	float fY = labF(Y);
+	float fZ = labF(Z);
+
+	return { 116 * fY - 16, 500 * (fX - fY), 200 * (fY - fZ) };
+}
+
+struct Diff {
+	float meanDeltaE = 0;
+	float badPixels  = 0;
+};
+
+Diff compareImages( const Pixels& A, const Pixels& B, float maxDeltaE ){
+	Diff diff;
+
+	size_t count = A.size() / 3;
+	size_t bad   = 0;
+
+	double sum = 0;
+
+	for ( size_t i = 0; i < count; i++ ){
+		Lab a = toLab(&A[i * 3]);
+		Lab b = toLab(&B[i * 3]);
+
+		float dE = sqrtf((a.L-b.L)*(a.L-b.L) + (a.a-b.a)*(a.a-b.a) + (a.b-b.b)*(a.b-b.b));
+
+		sum += dE;
+
+		if ( dE > maxDeltaE )
+			bad++;
+	}
+
+	diff.meanDeltaE = (float) (sum / count);
+	diff.badPixels  = (float) bad / count;
+
+	return diff;
+}
+
+// Render times of earlier runs, keyed by view name and resolution
+typedef std::map<std::string, std::vector<double>> History;
+
+std::string historyKey( const std::string& view, int w, int h ){
+	return view + "@" + std::to_string(w) + "x" + std::to_string(h);
+}
+
+History readHistory( const std::string& path ){
+	History history;
+
+	FILE* file = fopen(path.c_str(), "r");
+
+	if ( !file )
+		return history;
+
+	char commit[256];
+	char view[256];
+
+	int    w, h;
+	double ms;
+
+	// Skip the header
+	fscanf(file, "%*[^\n]\n");
+
+	while ( fscanf(file, "%255[^,],%255[^,],%d,%d,%lf\n", commit, view, &w, &h, &ms) == 5 )
+		history[historyKey(view, w, h)].push_back(ms);
+
+	fclose(file);
+	return history;
+}
+
+// Median of the last few runs, single outliers should not decide the verdict
+double recentTime( const std::vector<double>& runs ){
+	std::vector<double> recent(runs.end() - std::min<size_t>(runs.size(), 5), runs.end());
+	std::sort(recent.begin(), recent.end());
+
+	return recent[recent.size() / 2];
+}
+
+double renderView( const Scene& scene, const View& view, const Options& opts, Pixels& rgb, float& shadowHitRate ){
+	Camera cam = demoCamera();
+	 cam.T = view.T;
+	 cam.C = view.C;
+
+	if ( view.preset )
+		applyDemoPreset(cam, view.preset);
+
+	RenderOptions options;
+	 options.width   = opts.width;
+	 options.height  = opts.height;
+	 options.threads = opts.threads;
+
+	Renderer renderer;
+
+	// Untimed warm-up, first touches of the scene and image are noisy
+	RenderResult result = renderer.renderNow(scene, cam, options);
+
+	shadowHitRate = result.shadows.hitRate();
+
+	double best = -1;
+
+	for ( int run = 0; run < opts.repeat; run++ ){
+		auto start = std::chrono::steady_clock::now();
+
+		result = renderer.renderNow(scene, cam, options);
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if ( best < 0 || ms < best )
+			best = ms;
+	}
+
+	const std::vector<Color>& image = result.image.pixels;
+
+	rgb.resize(image.size() * 3);
+
+	for ( size_t i = 0; i < image.size(); i++ ){
+		rgb[i * 3 + 0] = toByte(image[i].r);
+		rgb[i * 3 + 1] = toByte(image[i].g);
+		rgb[i * 3 + 2] = toByte(image[i].b);
+	}
+
+	return best;
+}
+
+bool parseArgs( int argc, char** argv, Options& opts ){
+	for ( int i = 1; i < argc; i++ ){
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if ( !strcmp(arg, "--update") ){
+			opts.update = true;
+		} else if ( hasValue && !strcmp(arg, "--history") ){
+			opts.history = argv[++i];
+		} else if ( hasValue && !strcmp(arg, "--commit") ){
+			opts.commit = argv[++i];
+		} else if ( hasValue && !strcmp(arg, "--width") ){
+			opts.width = atoi(argv[++i]);
+		} else if ( hasValue && !strcmp(arg, "--height") ){
+			opts.height = atoi(argv[++i]);
+		} else if ( hasValue && !strcmp(arg, "--threads") ){
+			opts.threads = atoi(argv[++i]);
+		} else if ( hasValue && !strcmp(arg, "--repeat") ){
+			opts.repeat = std::max(1, atoi(argv[++i]));
+		} else if ( hasValue && !strcmp(arg, "--max-delta-e") ){
+			opts.maxDeltaE = (float) atof(argv[++i]);
+		} else if ( hasValue && !strcmp(arg, "--max-bad-pixels") ){
+			opts.maxBadPixels = (float) atof(argv[++i]);
+		} else if ( hasValue && !strcmp(arg, "--max-slowdown") ){
+			opts.maxSlowdown = (float) atof(argv[++i]);
+		} else if ( arg[0] != '-' && opts.golden.empty() ){
+			opts.golden = arg;
+		} else {
+			fprintf(stderr, "Unknown argument: %s\n", arg);
+			return false;
+		}
+	}
+
+	if ( opts.golden.empty() ){
+		fprintf(stderr, "Usage: %s <golden dir> [--update] [--history <csv>] [--commit <id>]\n", argv[0]);
+		return false;
+	}
+
+	return opts.width > 0 && opts.height > 0;
+}
+
+int main( int argc, char** argv ){
+	Options opts;
+
+	if ( !parseArgs(argc, argv, opts) )
+		return 2;
+
+	std::unique_ptr<Scene> scene = makeDemoScene();
+
+	History history = readHistory(opts.history);
+
+	FILE* historyFile = fopen(opts.history.c_str(), "a");
+
+	if ( !historyFile ){
+		fprintf(stderr, "Cannot open history file %s\n", opts.history.c_str());
+		return 2;
+	}
+
+	fseek(historyFile, 0, SEEK_END);
+
+	if ( ftell(historyFile) == 0 )
+		fprintf(historyFile, "commit,view,width,height,ms\n");
+
+	int failures = 0;
+
+	for ( const View& view : views ){
+		std::string refPath = opts.golden + "/" + view.name + ".ppm";
+
+		Pixels rgb;
+		float shadowHitRate;
+
+		double ms = renderView(*scene, view, opts, rgb, shadowHitRate);
+
+		printf("%-20s %8.1f ms  shadow cache %5.1f%%", view.name, ms, shadowHitRate * 100);
+
+		fprintf(historyFile, "%s,%s,%d,%d,%.3f\n", opts.commit.c_str(), view.name, opts.width, opts.height, ms);
+
+		if ( opts.update ){
+			bool ok = writePPM(refPath, rgb, opts.width, opts.height);
+
+			printf("  %s\n", ok ? "updated" : "FAIL cannot write reference");
+			failures += !ok;
+			continue;
+		}
+
+		bool ok = true;
+
+		Pixels ref;
+		int refW, refH;
+
+		if ( !readPPM(refPath, ref, refW, refH) || refW != opts.width || refH != opts.height ){
+			printf("  FAIL missing reference at %dx%d", opts.width, opts.height);
+			ok = false;
+		} else {
+			Diff diff = compareImages(rgb, ref, opts.maxDeltaE);
+
+			printf("  dE %5.2f  bad %6.3f%%", diff.meanDeltaE, diff.badPixels * 100);
+
+			if ( diff.badPixels > opts.maxBadPixels ){
+				printf("  FAIL image");
+				ok = false;
+			}
+		}
+
+		auto runs = history.find(historyKey(view.name, opts.width, opts.height));
+
+		if ( runs != history.end() ){
+			double prev = recentTime(runs->second);
+
+			printf("  (was %.1f ms)", prev);
+
+			if ( ms > prev * (1 + opts.maxSlowdown) ){
+				printf("  FAIL time");
+				ok = false;
+			}
+		}
+
+		printf("\n");
+		failures += !ok;
+	}
+
+	fclose(historyFile);
+
+	if ( failures ){
+		printf("%d of %d views failed\n", failures, (int) (sizeof(views) / sizeof(views[0])));
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1055 @@
+#pragma once
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdlib.h>
+
+#include <tuple>
+#include <type_traits>
+
+#define PI M_PI
+
+const float rOff = 0.01;
+ 
+struct Vector {
+	float x, y, z;
+ 
+	Vector() : x(0), y(0), z(0) 
+	{}
+	Vector(float x, float y, float z) : x(x), y(y), z(z)
+	{}
+ 
+	float  operator*(const Vector& v) const {
+		return (x * v.x + y * v.y + z * v.z);
+	}
+ 
+	Vector operator%(const Vector& v) const {
+		return Vector(y*v.z-z*v.y, z*v.x - x*v.z, x*v.y - y*v.x);
+	}
+ 
+	Vector operator*(float s) const { return Vector(x *s, y *s, z *s); }
+	Vector operator/(float s) const { return Vector(x /s, y /s, z /s); }
+ 
+	Vector operator+(const Vector& v) const { return Vector(x + v.x, y + v.y, z + v.z); }
+	Vector operator-(const Vector& v) const { return Vector(x - v.x, y - v.y, z - v.z); }
+ 
+	Vector operator-() const { return Vector(-x, -y, -z); }
+ 
+	Vector normal() const { 
+		float s = len();
+ 
+		return Vector(x /s, y /s, z /s);
+	}
+ 
+	float len() const { 
+		return sqrt(x*x + y*y + z*z); 
+	}
+};
+struct Color {
+	float r, g, b;
+ 
+	Color( float i = 0 ) : r(i), g(i), b(i)
+	{}
+ 
+	Color( float r, float g, float b ) : r(r), g(g), b(b)
+	{}
+ 
+	Color operator*( float s ) const {
+		return Color(r * s, g * s, b * s);
+	}
+	Color operator*( const Color& c ) const {
+		return Color(r * c.r, g * c.g, b * c.b);
+	}
+ 
+	Color operator/( const Color& c ) const {
+		return Color(r / c.r, g / c.g, b / c.b);    
+	}
+ 
+	Color operator+( const Color& c ) const {
+		return Color(r + c.r, g + c.g, b + c.b);
+	}
+	Color operator-( const Color& c ) const {
+		return Color(r - c.r, g - c.g, b - c.b);
+	}
+};
+ 
+ 
+class SceneObj;
+ 
+struct Ray {
+	float T;
+	float C;
+ 
+	Vector origin;
+	Vector dir;
+};
+ 
+struct HitRes {
+	Ray ray;
+ 
+	SceneObj* obj;
+ 
+	Vector pos;
+	Vector normal;
+ 
+	float frac;
+ 
+	float u;
+	float v;
+
+	HitRes( const Ray& ray ) : 
+		ray(ray), 
+ 
+		obj(NULL),
+		frac(-1),
+ 
+		u(0),
+		v(0)
+	{}
+ 
+	float getT() const {
+		return ray.T - (frac / ray.C);
+	}
+
+	Ray createRay( Vector dir ) const {
+		return createRay(dir, ray.C);
+	}
+ 
+	Ray createRay( Vector dir, float C ) const {
+		Ray out;
+		 out.T      = getT();
+		 out.C      = C;
+ 
+		 out.dir    = dir;
+		 out.origin = pos + dir * rOff;
+ 
+		return out;
+	}
+};
+ 
+const int MAT_SHADOW_CASTER     = (1 << 0);
+const int MAT_REFLECT         = (1 << 1); 
+const int MAT_REFRACT         = (1 << 2);
+ 
+class Material {
+	public:
+		int flags;
+ 
+		Material( int flags ) :
+			flags(flags)
+		{}
+ 
+		virtual Color shade( Vector normal, Vector viewDir, Vector lightDir, Color rad ) const {
+			return Color(0);
+		}
+		virtual Color Freshnel( Vector dir, Vector normal ) const {
+			return Color(0);
+		}
+ 
+		// Base color for the denoiser, mirror-like materials show what they reflect
+		virtual Color albedo() const {
+			return Color(1);
+		}
+ 
+		virtual Ray reflect( const HitRes& res ) const {
+			return Ray();
+		}
+		virtual Ray refract( const HitRes& res ) const {
+			return Ray();
+		}
+};
+ 
+// Forrás: VIK Wiki, F0 approximáció
+inline Color calcFreshnelF0( Color n, Color k ){
+	return ((n-1)*(n-1) + k*k) / ((n+1)*(n+1) + k*k);
+}
+ 
+class SmoothMaterial final : public Material {
+	public:
+		Color F0;
+		float n;
+ 
+		SmoothMaterial( float n, Color k ) :
+			Material(MAT_REFLECT | MAT_REFRACT),
+ 
+			F0( calcFreshnelF0(Color(n), k) ),
+			n(n)
+		{}
+ 
+		SmoothMaterial( Color n, Color k ) :
+			Material(MAT_SHADOW_CASTER | MAT_REFLECT),
+			
+			F0( calcFreshnelF0(n, k) ),
+			n(0)
+		{}
+ 
+		Color Freshnel( Vector dir, Vector normal ) const {
+			float cosA = fabs(normal * dir);
+ 
+			return F0 + (Color(1) - F0) * pow(1-cosA, 5);
+		}
+ 
+ 
+		virtual Ray reflect( const HitRes& res ) const {
+			Vector dir    = res.ray.dir;
+			Vector normal = res.normal;
+ 
+			Vector out = dir - normal * (normal * dir) * 2.0f;
+ 
+			return res.createRay(out);
+		}
+		virtual Ray refract( const HitRes& res ) const {
+			Vector dir    = res.ray.dir;
+			Vector normal = res.normal;
+ 
+			float ior  = n;
+			float cosA = -(normal * dir);
+		
+			if ( cosA < 0 ){
+				cosA   = -cosA;
+				normal = -normal;
+				
+				ior = 1/n;
+			}
+ 
+			float disc = 1 - (1 - cosA*cosA)/(ior*ior);
+ 
+			if ( disc < 0 )
+				return reflect(res);
+ 
+			Vector out  = dir/ior + normal * (cosA/ior - sqrt(disc));
+			float  outC = res.ray.C /ior;
+ 
+			return res.createRay(out, outC);
+		}
+};
+class RoughMaterial final : public Material {
+	public:
+		Color kd, ks;
+ 
+		float shiny;
+ 
+		RoughMaterial( Color flat, float shiny = 0.5 ) :
+			Material(MAT_SHADOW_CASTER),
+ 
+			kd(flat),
+			ks(flat),
+			shiny(shiny)
+		{}
+ 
+		RoughMaterial( Color kd, Color ks, float shiny = 0.5 ) :
+			Material(MAT_SHADOW_CASTER),
+ 
+			kd(kd),
+			ks(ks),
+			shiny(shiny)
+		{}
+ 
+		virtual Color albedo() const {
+			return kd;
+		}
+ 
+		virtual Color shade( Vector normal, Vector viewDir, Vector lightDir, Color inRad ) const {
+			Color rad;
+ 
+			float cosT = normal * lightDir;
+			if ( cosT > 0 )
+				rad = rad + inRad * kd * cosT;
+ 
+			float cosD = normal * (viewDir + lightDir).normal();
+			if ( cosD > 0 )
+				rad = rad + inRad * ks * pow(cosD, shiny);
+ 
+			return rad;
+		}
+};
+ 
+ 
+class Matrix {
+	float 
+		m00, m01, m02,
+		m10, m11, m12,
+		m20, m21, m22;
+	
+	public:
+		static Matrix identity(){ 
+			return Matrix(
+				1, 0, 0, 
+				0, 1, 0, 
+				0, 0, 1
+			); 
+		}
+ 
+		static Matrix rotateX( float A ){
+			float sinA = sin(A);
+			float cosA = cos(A);
+ 
+			return Matrix(
+				cosA,  sinA, 0,
+				-sinA, cosA, 0,
+				0,     0,    1
+			);
+		}
+		static Matrix rotateY( float A ){
+			float sinA = sin(A);
+			float cosA = cos(A);
+ 
+			return Matrix(
+				cosA,  0, -sinA,
+				0,     1,     0,
+				sinA,  0,  cosA
+			);
+		}
+		static Matrix rotateZ( float A ){
+			float sinA = sin(A);
+			float cosA = cos(A);
+ 
+			return Matrix(
+				1,     0,    0,
+				0,  cosA, sinA,
+				0, -sinA, cosA
+			);
+		}
+		
+		static Matrix scale( const Vector& S ){
+			return Matrix(
+				S.x, 0, 0,
+				0, S.y, 0,
+				0, 0, S.z
+			);
+		}
+ 
+		Matrix( float I = 1.0f ) :
+			m00(I), m01(0), m02(0), 
+			m10(0), m11(I), m12(0), 
+			m20(0), m21(0), m22(I)
+		{}
+ 
+		Matrix(
+			float m00, float m01, float m02,
+			float m10, float m11, float m12,
+			float m20, float m21, float m22
+		) :
+			m00(m00), m01(m01), m02(m02), 
+			m10(m10), m11(m11), m12(m12), 
+			m20(m20), m21(m21), m22(m22)
+		{}
+ 
+		#define MM(R, C) m##R##0 * B.m0##C + m##R##1 * B.m1##C + m##R##2 * B.m2##C 
+		#define MV(R)    m##R##0 * B.x     + m##R##1 * B.y     + m##R##2 * B.z
+ 
+		Matrix operator*( const Matrix& B ) const {
+			return Matrix(
+				MM(0,0),  MM(0,1),  MM(0,2),
+				MM(1,0),  MM(1,1),  MM(1,2),
+				MM(2,0),  MM(2,1),  MM(2,2)    
+			);
+		}
+ 
+		Vector operator*( const Vector& B ) const {
+			return Vector(
+				MV(0),
+				MV(1),
+				MV(2)
+			);
+		}
+ 
+};
+ 
+ 
+ 
+ 
+ 
+struct Light {
+	Vector origin;
+	Vector vel;
+ 
+	Color rad;
+ 
+	Light( Vector origin, Vector vel, Color rad ) : 
+		origin(origin),
+		vel(vel),
+		rad(rad)
+	{}
+ 
+ 
+	bool calcPastPosition( const HitRes& res, float T, float C, Vector& out ) const {
+		Vector A(origin + vel * T);
+		Vector V(vel);
+		Vector P(res.pos);
+ 
+		float a = V*V - C*C;
+		float b = 2*(A*V - V*P);
+		float c = (A-P)*(A-P);
+ 
+		float det = b*b - 4*a*c;
+ 
+		// No photons will reach the point until time
+		if ( det < 0 )
+			return false;
+ 
+		float z0 = (-b+sqrt(det))/(2*a);
+		float z1 = (-b-sqrt(det))/(2*a);
+ 
+		// Target time
+		float delta = z0 < z1 ? z0 : z1;
+		
+		out = A + vel * delta;
+		return true;
+	}
+ 
+};
+ 
+class SceneObj {
+	Material* mat; 
+ 
+	public:
+		Vector origin;
+ 
+		SceneObj( Material* mat, Vector origin ) :
+			mat(mat),
+			origin(origin)
+		{}
+ 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			return HitRes(ray);
+		};
+ 
+		virtual Material* material() const {
+			return mat;
+		}
+};
+ 
+ 
+class ScenePlane final : public SceneObj {
+ 
+	public:
+		Vector normal;
+		Vector up;
+ 
+		ScenePlane( Material* mat, const Vector origin, const Vector normal, const Vector up ) :
+			SceneObj(mat, origin),
+ 
+			normal(normal.normal()),
+			up(up.normal())
+		{}
+ 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			float frac = ((origin - ray.origin) *normal)/(ray.dir * normal);
+ 
+			HitRes res(ray);
+ 
+			if ( frac > 0 ){
+				res.frac   = frac;
+				res.normal = normal;
+ 
+				res.pos = ray.origin + ray.dir * frac;
+ 
+				res.u = (up          ) * (res.pos - origin);
+				res.v = (up%normal) * (res.pos - origin);
+			}
+ 
+			return res;
+		}
+};
+ 
+class SceneParaboloid final : public SceneObj {
+ 
+	public:	 
+		Vector focus;
+	 
+		SceneParaboloid( Material* mat, const Vector origin, Vector focus ) :
+			SceneObj(mat, origin),
+	 
+			focus(focus)
+		{}
+	 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			Vector A(ray.origin);
+			Vector B(ray.dir);
+	 
+			Vector F(origin +focus);
+			Vector D(origin -focus);
+	 
+			Vector N = (F-D).normal();
+	 
+			float a = (B*N)*(B*N) - B*B;
+			float b = ((A*N)*(B*N) - A*B - (B*N)*(D*N) + B*F) * 2;
+			float c = ((A*N)*(A*N) - A*A - (A*N)*(D*N)*2 + A*F * 2 + (D*N)*(D*N) - F*F);
+	 
+			float det = b*b - 4*a*c;
+	 
+			HitRes out(ray);
+	 
+			if ( det > 0 ){
+				float t0 = (-b + sqrt(det))/(2*a);
+				float t1 = (-b - sqrt(det))/(2*a);
+	 
+				// Accept greater T as solution
+				float T = t0 > t1 ? t0 : t1;
+	 
+				if ( T > 0 ){
+					out.frac  = T;
+					out.pos   = A + B*T;
+ 
+					Vector fDir = (F - out.pos).normal();
+ 
+					out.normal = (N + fDir).normal();
+				}
+			}
+	 
+			return out;
+		}
+};
+ 
+ 
+class SceneSphere final : public SceneObj {
+	float radius;
+ 
+	public:
+		SceneSphere( Material* mat, const Vector origin, float radius = 1 ) :
+			SceneObj(mat, origin),
+			radius(radius)
+		{}
+ 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			float fracBase = ray.dir * (origin - ray.origin);
+ 
+			Vector proj = ray.origin + ray.dir * fracBase;
+			float dist  = (origin - proj).len(); 
+ 
+			HitRes res(ray);
+ 
+			if ( dist <= radius ){
+				float fracOff = sqrt(radius*radius - dist*dist);
+				float frac;
+ 
+				if ( fracBase < fracOff )
+					frac = fracBase + fracOff;
+				else
+					frac = fracBase - fracOff;
+ 
+				if ( frac <= 0 )
+					return res;
+
+				res.frac   = frac;
+				res.pos    = ray.origin + ray.dir * frac;
+ 
+				res.normal = (res.pos - origin).normal();
+			}
+ 
+			return res;
+		}
+};
+class SceneEllipse final : public SceneObj {
+	SceneSphere sphere;
+ 
+	Matrix localToWorld;
+	Matrix localToWorldN;
+ 
+	Matrix worldToLocal;
+ 
+	public:
+		SceneEllipse( Material* mat, Vector origin ) :
+			SceneObj(mat, origin),
+			
+			sphere(mat, origin, 1)
+		{
+			Vector S(2,1,0.5);
+
+			float rotX = PI/4;
+			float rotY = PI/4;
+
+			Matrix scale  = Matrix::scale(S);
+			Matrix scaleI = Matrix::scale( Vector(1.0f/S.x, 1.0f/S.y, 1.0f/S.z) );
+ 
+			Matrix rotate  = Matrix::rotateX( rotX) * Matrix::rotateY( rotY);
+			Matrix rotateI = Matrix::rotateY(-rotY) * Matrix::rotateX(-rotX);
+ 
+			localToWorld  = rotate * scale;
+			localToWorldN = rotate * scaleI;
+ 
+			worldToLocal  = scaleI * rotateI;
+		}
+ 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+ 
+			Ray local = ray;
+			 local.origin = (worldToLocal * local.origin);
+			 local.dir    = (worldToLocal * local.dir).normal();
+ 
+			HitRes res = sphere.tryHitObject(local);
+ 
+			if ( res.frac > 0 ){
+				res.pos    = (localToWorld  * res.pos);
+				res.normal = (localToWorldN * res.normal).normal();
+ 
+				res.frac   = (ray.origin - res.pos).len();
+			}
+ 
+			return res;
+		}
+};
+ 
+ 
+// Target type is deduced from the constructor, so a mover wrapping a final
+// shape calls its intersection kernel directly instead of through the vtable
+template<typename Target = SceneObj>
+class SceneMover final : public SceneObj {
+	Target* target;
+	Vector  velocity;
+ 
+	public:
+		SceneMover( Target* target, const Vector origin, const Vector velocity ) :
+			SceneObj(NULL, origin),
+ 
+			target(target),
+			velocity(velocity)
+		{}
+ 
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			Vector baseOff = velocity * ray.T - origin;       // Object moved this far already since T0
+			Vector pVel    = ray.dir  * ray.C - velocity;     // Particle speed
+ 
+			Ray helper;
+			 helper.origin = ray.origin - baseOff;
+			 helper.dir    = pVel.normal();
+ 
+			HitRes res = target->tryHitObject(helper);
+ 
+			if ( res.frac > 0 ){
+				float delta = res.frac / pVel.len();    // Time passed until the particle hit
+ 
+				HitRes out(ray);
+				 out.pos    = baseOff + res.pos + velocity * delta;  // Transform back to global coordinates
+				 out.normal = res.normal;                            // Translation is invariant to normals
+ 
+				 out.frac   = (ray.origin - out.pos).len();
+ 
+				// Final hitpoint is on the original trace line, therefore the projection was correct
+				if ( fabs(ray.dir * (out.pos - ray.origin) - out.frac) > 0.0005 )
+					exit(1);
+ 
+				return out;
+			}
+ 
+			// Trace missed, no point in transforming
+			return res;
+		}
+ 
+		virtual Material* material() const {
+			return target->material();
+		}
+};
+
+template<typename TA = SceneObj, typename TB = SceneObj>
+class SceneBoolean final : public SceneObj {
+	TA* A;
+	TB* B;
+
+	public:
+		SceneBoolean( TA* A, TB* B ) :
+			SceneObj(NULL, Vector()),
+
+			A(A),
+			B(B)
+		{}
+
+		static void fixResult( HitRes& res, const Ray& ray, float baseFrac ){
+			// Frac must be corrected, as recursive calls cast rays 'closer' to
+			// the object, therefore the discarded intersection frac must be taken
+			// into account
+			res.ray = ray;
+
+			if ( res.frac > 0 )
+				res.frac += baseFrac + rOff;
+		}
+
+		virtual HitRes tryHitObject( const Ray& ray ) const {
+			HitRes hitA = A->tryHitObject(ray);
+
+			if ( hitA.frac < 0 )
+				return hitA;
+
+			HitRes hitB = B->tryHitObject(ray);
+
+			if ( hitB.frac < 0 )
+				return hitA;
+
+			HitRes miss(ray);
+
+			// A - B
+			bool insideA  = (hitA.normal * ray.dir) > 0;
+			bool insideB  = (hitB.normal * ray.dir) > 0;
+
+			bool isAFirst = hitA.frac < hitB.frac;
+
+			// Turn B inside out
+			hitB.normal = hitB.normal * -1;
+
+			if ( hitA.frac > 0 ){
+				if ( hitB.frac > 0 ){
+
+					if ( insideA ) {
+						
+						if ( insideB ){
+						
+							if ( isAFirst ){
+								// inside A, inside B = AB -> B, discard
+								return miss;
+							} else {
+								// inside B, inside A = B -> A, inverse B
+								return hitB;
+							}
+						} else {
+							// Hit inside of A, outside of B = A/B -> 0 -> B/A
+							return hitA;
+						}
+					} else {
+
+						if ( insideB ){
+						
+							if ( isAFirst ){
+								// outsideA, inside B = Skip intersection with A, trace recursively
+								HitRes res = tryHitObject( hitA.createRay(ray.dir) );
+
+								fixResult(res, ray, hitA.frac);
+								return res;
+							} else {
+								// inside B, outside A = B -> 0 -> A, valid
+								return hitA;
+							}
+						} else {
+						
+							if ( isAFirst ){
+								// outside A, outside B = 0 -> A. valid
+								return hitA;
+							} else {
+								// outside B, outside A = Skip intersections with B, trace recursively
+								HitRes res = tryHitObject( hitB.createRay(ray.dir) );
+
+								fixResult(res, ray, hitB.frac);
+								return res;
+							}
+						}
+					}
+
+				}
+
+				// Hitpoint on A is valid if the ray does not hit B at all
+				return hitA;
+			}
+
+			// Miss
+			return miss;
+		}
+
+		virtual Material* material() const {
+			return A->material();
+		}
+};
+
+
+// Scene assembled at runtime, every object is reached through SceneObj virtuals
+class SceneList {
+	SceneObj** objects;
+
+	public:
+		Light light;
+		Color ambient;
+
+		SceneList( SceneObj** objects, const Light& light, Color ambient = Color(0) ) :
+			objects(objects),
+
+			light(light),
+			ambient(ambient)
+		{}
+
+		template<int Mask = 0>
+		HitRes tryHit( const Ray& ray ) const {
+			HitRes out(ray);
+ 
+			for ( int index = 0; objects[index] != NULL; index++ ){
+				SceneObj* obj = objects[index];
+ 
+				// Only trace for certain material types
+				if ((obj->material()->flags & Mask) != Mask)
+					continue;
+ 
+				HitRes hit = obj->tryHitObject(ray);
+ 
+				if ( hit.frac > 0 ){
+					hit.obj = obj;
+ 
+					if ( out.frac < 0 || out.frac > hit.frac )
+						out = hit;
+				}
+			}
+
+			return out;
+		}
+
+		template<typename Fn>
+		Color shade( const HitRes& res, Fn fn ) const {
+			Material* mat = res.obj->material();
+
+			return fn(*mat, mat->flags);
+		}
+};
+
+// Scene entry with its concrete object/material types and flags known at compile time
+template<typename Obj, typename Mat, int Flags>
+struct StaticObj {
+	using flags = std::integral_constant<int, Flags>;
+
+	Obj& obj;
+	const Mat& mat;
+};
+
+template<typename Mat, int Flags, typename Obj>
+StaticObj<Obj, Mat, Flags> bindStatic( Obj& obj ){
+	Material* mat = obj.material();
+
+	// Entry disagrees with the material it was bound to
+	if ( mat->flags != Flags )
+		exit(1);
+
+	return { obj, *static_cast<const Mat*>(mat) };
+}
+
+// Scene fixed at build time. The object list is unrolled into straight-line
+// code, intersection kernels and materials are called without virtual dispatch,
+// and material flag checks fold away.
+template<typename... Objs>
+class StaticScene {
+	std::tuple<Objs...> objects;
+
+	template<int Mask, typename Entry>
+	static void tryHitEntry( const Entry& entry, const Ray& ray, HitRes& out ){
+		if constexpr ((Entry::flags::value & Mask) == Mask) {
+			HitRes hit = entry.obj.tryHitObject(ray);
+
+			if ( hit.frac > 0 ){
+				hit.obj = &entry.obj;
+
+				if ( out.frac < 0 || out.frac > hit.frac )
+					out = hit;
+			}
+		}
+	}
+
+	public:
+		Light light;
+		Color ambient;
+
+		StaticScene( const Light& light, Color ambient, Objs... objects ) :
+			objects(objects...),
+
+			light(light),
+			ambient(ambient)
+		{}
+
+		template<int Mask = 0>
+		HitRes tryHit( const Ray& ray ) const {
+			HitRes out(ray);
+
+			std::apply([&]( const auto&... entry ){
+				(tryHitEntry<Mask>(entry, ray, out), ...);
+			}, objects);
+
+			return out;
+		}
+
+		template<typename Fn>
+		Color shade( const HitRes& res, Fn fn ) const {
+			Color rad;
+
+			std::apply([&]( const auto&... entry ){
+				((res.obj == &entry.obj && (rad = fn(entry.mat, typename std::decay_t<decltype(entry)>::flags()), true)) || ...);
+			}, objects);
+
+			return rad;
+		}
+};
+
+inline int sign( float a ){
+	return a > 0 ? 1 : a < 0 ? -1 : 0;
+}
+ 
+// Remembers the object that blocked the last shadow ray towards the light.
+// Neighbouring shading points are usually shadowed by the same object, so it
+// is tested first and the full scene query only runs when it misses. Holds
+// mutable state, keep one per thread (or tile). Scenes have a single light,
+// a second one would need an entry of its own.
+struct ShadowCache {
+	struct Entry {
+		SceneObj* occluder;
+
+		long queries;   // Shadow rays cast
+		long blocked;   // Shadow rays that found an occluder
+		long hits;      // Shadow rays resolved by the cached occluder alone
+
+		Entry() :
+			occluder(NULL),
+
+			queries(0),
+			blocked(0),
+			hits(0)
+		{}
+	};
+
+	Entry light;
+
+	// Fraction of the shadowed points that skipped the full scene query
+	float hitRate() const {
+		return light.blocked ? (float) light.hits / light.blocked : 0;
+	}
+
+	void merge( const ShadowCache& other ){
+		light.queries += other.light.queries;
+		light.blocked += other.light.blocked;
+		light.hits    += other.light.hits;
+	}
+};
+
+// True if a shadow caster sits between the ray origin and dist along the ray
+template<typename SceneT>
+bool isOccluded( const SceneT& scene, ShadowCache::Entry& cache, const Ray& ray, float dist ){
+	cache.queries++;
+
+	if ( cache.occluder ){
+		HitRes hit = cache.occluder->tryHitObject(ray);
+
+		// Any caster closer than the light is enough, the nearest one is not needed
+		if ( hit.frac > 0 && hit.frac <= dist ){
+			cache.blocked++;
+			cache.hits++;
+			return true;
+		}
+	}
+
+	HitRes occluder = scene.template tryHit<MAT_SHADOW_CASTER>(ray);
+
+	if ( occluder.frac < 0 || occluder.frac > dist )
+		return false;
+
+	cache.blocked++;
+	cache.occluder = occluder.obj;
+	return true;
+}
+ 
+// Checkerboard pattern of the surfaces
+inline Color checker( const HitRes& res ){
+	float u = fmod(5 + res.u/5, 1);
+	float v = fmod(5 + res.v/5, 1);
+ 
+	if ( u > 0.5 == v > 0.5 )
+		return Color(0.8);
+ 
+	return Color(1);
+}
+ 
+// Geometry of the first hit along a camera ray, guides the denoiser
+struct Surface {
+	bool   hit;
+ 
+	Vector pos;
+	Vector normal;
+	Color  albedo;
+ 
+	Surface() :
+		hit(false),
+		albedo(0)
+	{}
+};
+ 
+template<typename SceneT>
+Color trace( const SceneT& scene, ShadowCache& shadows, const Ray& ray, int bounce, Surface* surface = NULL ){
+	if ( --bounce < 0 )
+		return scene.ambient;
+ 
+	HitRes res = scene.tryHit(ray);
+ 
+	if ( res.frac < 0 )
+		return scene.ambient;
+ 
+	// Flags are an integral_constant for static scenes, branches on them fold away
+	return scene.shade(res, [&]( auto& mat, auto flags ){
+		Color rad;
+ 
+		if ( surface ){
+			surface->hit    = true;
+			surface->pos    = res.pos;
+			surface->normal = res.normal;
+			surface->albedo = mat.albedo() * checker(res);
+		}
+ 
+		// Test if the light illuminates this point
+		Vector lightPos;
+ 
+		if ( scene.light.calcPastPosition(res, res.getT(), ray.C, lightPos) ){
+			Vector delta = (lightPos - res.pos);
+ 
+			Ray vRay = res.createRay( delta.normal() );
+ 
+			if ( !isOccluded(scene, shadows.light, vRay, delta.len()) )
+				rad = mat.shade(res.normal, -ray.dir, vRay.dir, scene.light.rad) * checker(res);
+		}
+ 
+		if ( flags & MAT_REFLECT ){
+			Ray in = mat.reflect(res);
+ 
+			rad = rad + trace(scene, shadows, in, bounce) * mat.Freshnel(ray.dir, res.normal);
+		}
+ 
+		if ( flags & MAT_REFRACT ){
+			Ray in = mat.refract(res);
+ 
+			rad = rad + trace(scene, shadows, in, bounce) * (Color(1) - mat.Freshnel(ray.dir, res.normal));
+		}
+
+		return rad;
+	});
+}
+ 
+ 
+struct Camera {
+	Vector pos;
+	Vector up;
+	Vector dir;
+ 
+	float fov;
+ 
+	float T;
+	float C;
+ 
+	// Ray through image position x, y, integer coordinates hit pixel corners
+	Ray pixelRay( float x, float y, int w, int h ) const {
+		float pX = (x / (float) w);
+		float pY = (y / (float) h);
+ 
+		pX = pX - 0.5;
+		pY = 0.5 - pY;
+ 
+		Vector vF = dir.normal();
+		Vector vU = up.normal();
+		Vector vR;
+ 
+		vR = vF % vU;
+		vU = vF % vR;
+ 
+		float fovU = fov;
+		float fovV = fov * (1280.0f/720.f);
+
+		Vector rayDir = dir + (vU * pY * fovU + vR * pX * fovV);
+ 
+		Ray ray;
+		 ray.T = T;
+		 ray.C = C;
+ 
+		 ray.origin = pos;
+		 ray.dir    = rayDir.normal();
+ 
+		return ray;
+	}
+};
@@ -0,0 +1,150 @@
+#include "renderer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+	// PCG output permutation, a stateless hash so every pixel draws the same
+	// jitter no matter which thread renders its tile
+	inline unsigned int pcgHash( unsigned int v ){
+		unsigned int state = v * 747796405u + 2891336453u;
+		unsigned int word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+
+		return (word >> 22u) ^ word;
+	}
+
+	// Uniform in [0, 1)
+	inline float jitter( unsigned int seed ){
+		return (pcgHash(seed) >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+RenderResult Renderer::renderNow( const Scene& scene, const Camera& camera, const RenderOptions& options, ProgressFn progress, CancelToken cancel ) const {
+	RenderResult result;
+	 result.image = Image(options.width, options.height);
+	 result.aux   = GBuffer(options.width, options.height);
+
+	const int w = options.width;
+	const int h = options.height;
+
+	const int samples = std::max(1, options.samples);
+
+	const int tile   = std::max(1, options.tileSize);
+	const int tilesX = (w + tile - 1) / tile;
+	const int tilesY = (h + tile - 1) / tile;
+	const int tiles  = tilesX * tilesY;
+
+	int threads = options.threads > 0 ? options.threads : (int) std::thread::hardware_concurrency();
+	threads = std::max(1, std::min(threads, tiles));
+
+	std::atomic<int> next(0);
+	std::atomic<int> done(0);
+
+	std::vector<ShadowCache> stats(threads);
+
+	auto worker = [&]( int id ){
+		while ( !cancel.cancelled() ){
+			int index = next++;
+
+			if ( index >= tiles )
+				break;
+
+			int x0 = (index % tilesX) * tile;
+			int y0 = (index / tilesX) * tile;
+
+			int x1 = std::min(x0 + tile, w);
+			int y1 = std::min(y0 + tile, h);
+
+			// A fresh cache per tile keeps the occluder local to neighbouring pixels
+			ShadowCache shadows;
+
+			for ( int y = y0; y < y1; y++ ){
+				for ( int x = x0; x < x1; x++ ){
+					Color  rad;
+					Vector pos;
+					Vector normal;
+					Color  albedo;
+					int    hits = 0;
+
+					for ( int s = 0; s < samples; s++ ){
+						float jx = 0;
+						float jy = 0;
+
+						if ( samples > 1 ){
+							unsigned int seed = pcgHash(pcgHash(x) ^ y) ^ (unsigned int) s;
+
+							jx = jitter(seed * 2);
+							jy = jitter(seed * 2 + 1);
+						}
+
+						Surface surface;
+
+						rad = rad + scene.trace(shadows, camera.pixelRay(x + jx, y + jy, w, h), options.bounces, &surface);
+
+						if ( surface.hit ){
+							pos    = pos + surface.pos;
+							normal = normal + surface.normal;
+							albedo = albedo + surface.albedo;
+							hits++;
+						}
+					}
+
+					int i = y * w + x;
+
+					result.image.pixels[i] = rad * (1.0f / samples);
+
+					if ( hits ){
+						result.aux.pos[i]    = pos / hits;
+						result.aux.albedo[i] = albedo * (1.0f / hits);
+
+						// Opposing normals of a silhouette may cancel out
+						if ( normal.len() > 0 )
+							result.aux.normal[i] = normal.normal();
+					}
+
+					result.aux.coverage[i] = (float) hits / samples;
+				}
+			}
+
+			stats[id].merge(shadows);
+
+			int finished = ++done;
+
+			if ( progress )
+				progress((float) finished / tiles);
+		}
+	};
+
+	std::vector<std::thread> pool;
+
+	for ( int id = 1; id < threads; id++ )
+		pool.emplace_back(worker, id);
+
+	worker(0);
+
+	for ( std::thread& thread : pool )
+		thread.join();
+
+	for ( const ShadowCache& shadows : stats )
+		result.shadows.merge(shadows);
+
+	result.cancelled = done < tiles;
+
+	if ( options.denoise && !result.cancelled ){
+		DenoiseOptions denoiser = options.denoiser;
+
+		if ( denoiser.threads <= 0 )
+			denoiser.threads = threads;
+
+		denoise(result.image.pixels.data(), result.aux, denoiser);
+	}
+
+	return result;
+}
+
+std::future<RenderResult> Renderer::render( const Scene& scene, const Camera& camera, const RenderOptions& options, ProgressFn progress, CancelToken cancel ) const {
+	// The task renders with a copy, the Renderer may go away before it ends
+	return std::async(std::launch::async, [renderer = *this, &scene, camera, options, progress, cancel](){
+		return renderer.renderNow(scene, camera, options, progress, cancel);
+	});
+}
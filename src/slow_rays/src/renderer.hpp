@@ -0,0 +1,120 @@
+#pragma once
+
+#include "raytracer.hpp"
+#include "denoise.hpp"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Anything the Renderer can draw. trace() is called from several threads at
+// once, implementations must not keep mutable state outside of shadows.
+class Scene {
+	public:
+		virtual ~Scene() {}
+
+		// Fills surface with the first hit when given
+		virtual Color trace( ShadowCache& shadows, const Ray& ray, int bounce, Surface* surface = NULL ) const = 0;
+};
+
+// Exposes a SceneList, StaticScene or any other type trace() accepts as a Scene
+template<typename Impl>
+class TracedScene : public Scene {
+	public:
+		Impl impl;
+
+		template<typename... Args>
+		TracedScene( Args&&... args ) :
+			impl(std::forward<Args>(args)...)
+		{}
+
+		virtual Color trace( ShadowCache& shadows, const Ray& ray, int bounce, Surface* surface = NULL ) const {
+			return ::trace(impl, shadows, ray, bounce, surface);
+		}
+};
+
+struct Image {
+	int width;
+	int height;
+
+	std::vector<Color> pixels;
+
+	Image( int width = 0, int height = 0 ) :
+		width(width),
+		height(height),
+
+		pixels(width * height)
+	{}
+
+	Color& at( int x, int y ){
+		return pixels[y * width + x];
+	}
+	const Color& at( int x, int y ) const {
+		return pixels[y * width + x];
+	}
+};
+
+struct RenderOptions {
+	int width  = 1280;
+	int height = 720;
+
+	int bounces = 6;
+
+	int threads  = 0;    // 0 uses every hardware thread
+	int tileSize = 32;
+
+	// Jittered samples per pixel, a single sample goes through the pixel corner
+	int samples = 1;
+
+	// Filter the image with the guide buffers once all tiles are done
+	bool denoise = false;
+	DenoiseOptions denoiser;
+};
+
+struct RenderResult {
+	Image image;
+
+	// First hits averaged over the samples of each pixel
+	GBuffer aux;
+
+	// Statistics of all tiles merged, the caches themselves are per tile
+	ShadowCache shadows;
+
+	bool cancelled = false;
+};
+
+// Shared flag to abandon a render, copies refer to the same flag
+class CancelToken {
+	std::shared_ptr<std::atomic<bool>> flag;
+
+	public:
+		CancelToken() :
+			flag(std::make_shared<std::atomic<bool>>(false))
+		{}
+
+		void cancel() const {
+			flag->store(true);
+		}
+
+		bool cancelled() const {
+			return flag->load();
+		}
+};
+
+// Receives the finished fraction of the image, called from the worker threads
+typedef std::function<void( float )> ProgressFn;
+
+// Renders scenes tile by tile on worker threads. Holds no state between
+// renders, any number of render() calls may run concurrently.
+class Renderer {
+	public:
+		// The scene must outlive the returned future, the Renderer need not.
+		// A cancelled render completes early with the tiles finished so far.
+		std::future<RenderResult> render( const Scene& scene, const Camera& camera, const RenderOptions& options, ProgressFn progress = ProgressFn(), CancelToken cancel = CancelToken() ) const;
+
+		// Renders on the calling thread plus the workers, returns once done
+		RenderResult renderNow( const Scene& scene, const Camera& camera, const RenderOptions& options, ProgressFn progress = ProgressFn(), CancelToken cancel = CancelToken() ) const;
+};